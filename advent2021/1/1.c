@@ -1,38 +1,257 @@
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "../read_input.h"
+#include <string.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "../input_stream.h"
 
-int main()
+/*
+ * part1: measurement larger than previous measurement,
+ * part2: sum of three larger than previous sum, i.e. measurement larger than the one three measurements ago
+ *  (since the two sums have the two measurements in between in common)
+ * So for a window of any size k, we count measurements i for which input[i] > input[i - k].
+ *
+ * Measurements are read in batches into a buffer, which keeps the last max window measurements of the batch
+ *  before, and are compared 8 (AVX2) or 4 (SSE2) at a time. A large file is split in parts (see
+ *  input_stream_open_part) which are counted on threads of their own, then the comparisons across parts are
+ *  done with the first and last max window measurements of each part.
+ */
+#define MAX_WINDOWS 8
+#define MAX_WINDOW 4096
+#define BATCH (1 << 14)
+#define MAX_THREADS 64
+
+typedef struct {
+    const char *file_name;
+    unsigned int part;
+    unsigned int nr_of_parts;
+    const unsigned int *windows;
+    unsigned int nr_of_windows;
+    unsigned int max_window;
+
+    /* result */
+    int rv;  // 0 on success
+    bool stopped;
+    unsigned long counts[MAX_WINDOWS];  // within the part
+    unsigned long nr_of_measurements;
+    int first[MAX_WINDOW];  // first max_window measurements (or all, if there are fewer)
+    int last[MAX_WINDOW];   // last max_window measurements
+    double io_wait, other;
+    const char *read_ahead;
+    int buffer[MAX_WINDOW + BATCH];
+} part;
+
+// nr of i < n for which later[i] > earlier[i]
+static unsigned long count_larger(const int *earlier, const int *later, size_t n)
 {
-    int *input;
-    unsigned int lines;
-    if (read_ints("input", &lines, &input) != 0 || !input) {
-        return 1;
+    unsigned long count = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i larger = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)(const void *)(later + i)),
+                                            _mm256_loadu_si256((const __m256i *)(const void *)(earlier + i)));
+        count += (unsigned long)__builtin_popcount((unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(larger)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i larger = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(const void *)(later + i)),
+                                         _mm_loadu_si128((const __m128i *)(const void *)(earlier + i)));
+        count += (unsigned long)__builtin_popcount((unsigned int)_mm_movemask_ps(_mm_castsi128_ps(larger)));
+    }
+#endif
+    // (counted without branches, which would be mispredicted half the time on noisy measurements)
+    for (; i < n; i++) {
+        count += later[i] > earlier[i];
+    }
+    return count;
+}
+
+static void *count_part(void *arg)
+{
+    part *p = arg;
+    int *buffer = p->buffer;
+    size_t kept = 0;  // measurements from batches before, at the start of buffer
+    enum input_stream_result rv = INPUT_STREAM_OK;
+
+    input_stream *input = input_stream_open_part(p->file_name, p->part, p->nr_of_parts);
+    if (!input) {
+        p->rv = 1;
+        return NULL;
+    }
+    while (rv == INPUT_STREAM_OK) {
+        size_t length = kept;
+        while (length < kept + BATCH && (rv = input_stream_next_int(input, &buffer[length])) == INPUT_STREAM_OK) {
+            length++;
+        }
+        if (p->nr_of_measurements == 0) {
+            memcpy(p->first, buffer, (length < p->max_window ? length : p->max_window) * sizeof(int));
+        }
+        p->nr_of_measurements += length - kept;
+
+        // the first measurements of the part are compared when the parts are put together
+        for (unsigned int w = 0; w < p->nr_of_windows; w++) {
+            size_t k = p->windows[w], from = kept > k ? kept : k;
+            if (length > from) {
+                p->counts[w] += count_larger(buffer + from - k, buffer + from, length - from);
+            }
+        }
+        kept = length < p->max_window ? length : p->max_window;
+        memmove(buffer, buffer + length - kept, kept * sizeof(int));
+    }
+    memcpy(p->last, buffer, kept * sizeof(int));
+    p->rv = rv == INPUT_STREAM_ERROR;
+    p->stopped = input_stream_stopped(input);
+    input_stream_times(input, &p->io_wait, &p->other, &p->read_ahead);
+    input_stream_close(input);
+    return NULL;
+}
+
+// count the parts (on threads of their own, if there are more than one), returns 0 on success
+static int count_parts(part *parts, unsigned int nr_of_parts)
+{
+    pthread_t threads[MAX_THREADS];
+    unsigned int started = 1;
+    for (; started < nr_of_parts; started++) {
+        if (pthread_create(&threads[started], NULL, count_part, &parts[started]) != 0) {
+            break;
+        }
+    }
+    count_part(&parts[0]);
+    for (unsigned int i = started; i < nr_of_parts; i++) {
+        count_part(&parts[i]);  // (could not start a thread)
+    }
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
     }
+    for (unsigned int i = 0; i < nr_of_parts; i++) {
+        if (parts[i].rv != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// add counts of the parts, and of the comparisons across parts, to counts
+static void add_parts(const part *parts, unsigned int nr_of_parts, unsigned long *counts,
+                      unsigned long *nr_of_measurements)
+{
+    const unsigned int *windows = parts[0].windows, max_window = parts[0].max_window;
+    int tail[MAX_WINDOW];  // last measurements of the parts before
+    size_t tail_length = 0;
 
-    // part1
-    unsigned int count = 0;
-    for (unsigned int i = 1; i < lines; i++) {
-        if (input[i] > input[i - 1]) {
-            count++;
+    for (unsigned int i = 0; i < nr_of_parts; i++) {
+        const part *p = &parts[i];
+        size_t first_length = p->nr_of_measurements < max_window ? p->nr_of_measurements : max_window;
+        for (unsigned int w = 0; w < p->nr_of_windows; w++) {
+            // measurement j of the part is compared with the one k before, which is in an earlier part if j < k
+            size_t k = windows[w];
+            counts[w] += p->counts[w];
+            for (size_t j = 0; j < first_length && j < k; j++) {
+                if (tail_length + j >= k) {
+                    counts[w] += p->first[j] > tail[tail_length + j - k];
+                }
+            }
+        }
+        *nr_of_measurements += p->nr_of_measurements;
+
+        size_t last_length = first_length;  // (the last max window measurements, unless the part has fewer)
+        if (last_length + tail_length > max_window) {
+            size_t drop = last_length + tail_length - max_window;
+            drop = drop < tail_length ? drop : tail_length;
+            memmove(tail, tail + drop, (tail_length - drop) * sizeof(int));
+            tail_length -= drop;
+        }
+        memcpy(tail + tail_length, p->last, last_length * sizeof(int));
+        tail_length += last_length;
+        if (p->stopped) {
+            break;  // the measurements end here, as when read by one thread
         }
     }
-    printf("%d measurements were larger than previous measurement\n", count);
+}
 
-    // part2
-    count = 0;
-    int prev_sum = input[0] + input[1] + input[2];
-    int cur_sum = 0;
+// Usage: 1.out [-t] [-j threads] [-w window]... [input file, or - for stdin]   (default: input)
+//  the input is read a batch of measurements at a time, so it may be of any size
+//  -t: print time spent waiting for reads and on the rest (to stderr)
+//  -j: nr of threads for a large file (default: nr of CPUs)
+//  -w: count sums of window measurements larger than previous sum (default: 1 and 3, as parts 1 and 2)
+int main(int argc, char **argv)
+{
+    int arg = 1;
+    bool print_times = false;
+    long nr_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int windows[MAX_WINDOWS] = {1, 3}, nr_of_windows = 0, max_window = 3;
+    while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+        if (strcmp(argv[arg], "-t") == 0) {
+            print_times = true;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nr_of_threads = atol(argv[++arg]);
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc && nr_of_windows < MAX_WINDOWS) {
+            long window = atol(argv[++arg]);
+            if (window < 1 || window > MAX_WINDOW) {
+                fprintf(stderr, "Invalid input given\n");
+                exit(1);
+            }
+            windows[nr_of_windows++] = (unsigned int)window;
+        } else {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+        arg++;
+    }
+    bool default_windows = nr_of_windows == 0;
+    if (default_windows) {
+        nr_of_windows = 2;
+    } else {
+        max_window = 0;
+        for (unsigned int w = 0; w < nr_of_windows; w++) {
+            max_window = windows[w] > max_window ? windows[w] : max_window;
+        }
+    }
+    nr_of_threads = nr_of_threads < 1 ? 1 : nr_of_threads > MAX_THREADS ? MAX_THREADS : nr_of_threads;
 
-    for (unsigned int i = 1; i < lines - 2; i++) {
-        cur_sum = input[i] + input[i + 1] + input[i + 2];
-        if (cur_sum > prev_sum) {
-            count++;
+    unsigned int nr_of_parts = (unsigned int)nr_of_threads;
+    part *parts = calloc(nr_of_parts, sizeof(part));
+    if (!parts) {
+        return 1;
+    }
+    for (unsigned int i = 0; i < nr_of_parts; i++) {
+        parts[i].file_name = arg < argc ? argv[arg] : "input";
+        parts[i].part = i;
+        parts[i].nr_of_parts = nr_of_parts;
+        parts[i].windows = windows;
+        parts[i].nr_of_windows = nr_of_windows;
+        parts[i].max_window = max_window;
+    }
+    if (count_parts(parts, nr_of_parts) != 0) {
+        free(parts);
+        return 1;
+    }
+    unsigned long counts[MAX_WINDOWS] = {0}, nr_of_measurements = 0;
+    add_parts(parts, nr_of_parts, counts, &nr_of_measurements);
+
+    if (print_times) {
+        // (summed over the threads)
+        double io_wait = 0, other = 0;
+        for (unsigned int i = 0; i < nr_of_parts; i++) {
+            io_wait += parts[i].io_wait;
+            other += parts[i].other;
         }
-        prev_sum = cur_sum;
+        fprintf(stderr, "%.3f s waiting for reads (read ahead: %s), %.3f s parsing and counting, %u threads\n",
+                io_wait, parts[0].read_ahead, other, nr_of_parts);
     }
-    printf("%d sums are larger than previous sum\n", count);
+    free(parts);
 
-    free(input);
+    if (default_windows) {
+        printf("%lu measurements were larger than previous measurement\n", counts[0]);
+        printf("%lu sums are larger than previous sum\n", counts[1]);
+        return 0;
+    }
+    for (unsigned int w = 0; w < nr_of_windows; w++) {
+        printf("%lu sums of %u are larger than previous sum\n", counts[w], windows[w]);
+    }
     return 0;
 }
@@ -1,66 +1,217 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "../read_input.h"
 
-int main()
+/*
+ * The commands are read as an enum column (one byte per command) and a column of their values.
+ *  part1: sums of the values of each command, 8 (AVX2) or 4 (SSE2) commands at a time
+ *  part2: aim is the sum of downs minus ups before a command, and depth the sum of forward * aim. The commands are
+ *         split in blocks (one per thread), and each block is solved as if aim is 0 at its start. Then the aim at
+ *         the start of each block is the sum of aims of the blocks before (prefix scan), which adds
+ *         aim * forwards of the block to its depth.
+ *  Sums are 64-bit, as the sum of many ints does not fit in an int, and depth and the answers (products) 128-bit
+ *  (a product which does not fit in that either is reported as too large).
+ */
+#define SCHEMA "command:enum(forward,down,up) value:int"
+enum command { FORWARD, DOWN, UP };  // as in SCHEMA
+
+__extension__ typedef __int128 int128;  // (gcc and clang)
+
+#define MIN_BLOCK (1 << 16)  // commands, fewer are not worth a thread of their own
+#define MAX_THREADS 64
+
+typedef struct {
+    const uint8_t *commands;
+    const int *values;
+    size_t nr_of_commands;
+
+    /* result */
+    long long sums[3];  // of values, per command
+    int128 depth;       // with aim 0 at the start of the block
+} block;
+
+#if defined(__AVX2__)
+// add the 4 ints of x as 64-bit to sum
+static __m256i add_wide(__m256i sum, __m128i x)
 {
-    unsigned int hits;
-    int *input_ints;
-    char **input_strs;
-    if (read_str_int("input", &hits, &input_strs, &input_ints) != 0) {
-        goto error;
+    return _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(x));
+}
+#elif defined(__SSE2__)
+static __m128i add_wide(__m128i sum, __m128i x)
+{
+    __m128i sign = _mm_srai_epi32(x, 31);
+    return _mm_add_epi64(_mm_add_epi64(sum, _mm_unpacklo_epi32(x, sign)), _mm_unpackhi_epi32(x, sign));
+}
+#endif
+
+// sums of values, per command
+static void sum_commands(const uint8_t *commands, const int *values, size_t n, long long sums[3])
+{
+    size_t i = 0;
+    sums[FORWARD] = sums[DOWN] = sums[UP] = 0;
+#if defined(__AVX2__)
+    __m256i wide[3] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+    for (; i + 8 <= n; i += 8) {
+        __m256i command = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(const void *)(commands + i)));
+        __m256i value = _mm256_loadu_si256((const __m256i *)(const void *)(values + i));
+        for (int c = FORWARD; c <= UP; c++) {
+            __m256i x = _mm256_and_si256(_mm256_cmpeq_epi32(command, _mm256_set1_epi32(c)), value);
+            wide[c] = add_wide(add_wide(wide[c], _mm256_castsi256_si128(x)), _mm256_extracti128_si256(x, 1));
+        }
     }
-    if (!input_ints || !input_strs) {
-        goto error;
+    for (int c = FORWARD; c <= UP; c++) {
+        long long lanes[4];
+        _mm256_storeu_si256((__m256i *)(void *)lanes, wide[c]);
+        sums[c] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
     }
-
-    /* part 1 */
-    int pos_x = 0, pos_y = 0;
-    char *str;
-    int num;
-    for (unsigned int i = 0; i < hits; i++) {
-        str = input_strs[i];
-        num = input_ints[i];
-
-        if (strcmp(str, "forward") == 0) {
-            pos_x += num;
-        } else if (strcmp(str, "down") == 0) {
-            pos_y += num;
-        } else if (strcmp(str, "up") == 0) {
-            pos_y -= num;
+#elif defined(__SSE2__)
+    __m128i wide[3] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+    for (; i + 4 <= n; i += 4) {
+        int packed;
+        memcpy(&packed, commands + i, sizeof(packed));
+        __m128i zero = _mm_setzero_si128();
+        __m128i command = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        __m128i value = _mm_loadu_si128((const __m128i *)(const void *)(values + i));
+        for (int c = FORWARD; c <= UP; c++) {
+            wide[c] = add_wide(wide[c], _mm_and_si128(_mm_cmpeq_epi32(command, _mm_set1_epi32(c)), value));
         }
     }
-    printf("i) %d\n", pos_x * pos_y);
+    for (int c = FORWARD; c <= UP; c++) {
+        long long lanes[2];
+        _mm_storeu_si128((__m128i *)(void *)lanes, wide[c]);
+        sums[c] = lanes[0] + lanes[1];
+    }
+#endif
+    for (; i < n; i++) {
+        sums[commands[i]] += values[i];
+    }
+}
 
-    /* part 2 */
-    pos_x = 0, pos_y = 0;
-    int velocity_down = 0;  //"aim", for every forward tick we will also go down by this much
-    for (unsigned int i = 0; i < hits; i++) {
-        str = input_strs[i];
-        num = input_ints[i];
-
-        if (strcmp(str, "forward") == 0) {
-            pos_x += num;
-            pos_y += num * velocity_down;
-
-        } else if (strcmp(str, "down") == 0) {
-            velocity_down += num;
-        } else if (strcmp(str, "up") == 0) {
-            velocity_down -= num;
+static void *solve_block(void *arg)
+{
+    block *b = arg;
+    long long aim = 0;
+    int128 depth = 0;
+
+    sum_commands(b->commands, b->values, b->nr_of_commands, b->sums);
+    // (without branches, which would be mispredicted on mixed commands)
+    for (size_t i = 0; i < b->nr_of_commands; i++) {
+        long long value = b->values[i];
+        aim += (b->commands[i] == DOWN) * value - (b->commands[i] == UP) * value;
+        depth += (int128)((b->commands[i] == FORWARD) * value) * aim;
+    }
+    b->depth = depth;
+    return NULL;
+}
+
+// solve the blocks, on threads of their own
+static void solve_blocks(block *blocks, unsigned int nr_of_blocks)
+{
+    pthread_t threads[MAX_THREADS];
+    unsigned int started = 1;
+    for (; started < nr_of_blocks; started++) {
+        if (pthread_create(&threads[started], NULL, solve_block, &blocks[started]) != 0) {
+            break;
         }
     }
-    printf("ii) %d\n", pos_x * pos_y);
+    solve_block(&blocks[0]);
+    for (unsigned int i = started; i < nr_of_blocks; i++) {
+        solve_block(&blocks[i]);  // (could not start a thread)
+    }
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
 
-error:
-    if (input_ints) {
-        free(input_ints);
+// print label and the product a * b (printf has no conversion for 128 bits)
+static void print_product(const char *label, int128 a, int128 b)
+{
+    char digits[41];  // (39 digits at most, and a sign)
+    char *p = digits + sizeof(digits) - 1;
+    int128 value;
+    if (__builtin_mul_overflow(a, b, &value)) {
+        printf("%s%s\n", label, "(too large, does not fit in 128 bits)");
+        return;
+    }
+    bool negative = value < 0;
+    *p = '\0';
+    do {
+        int digit = (int)(value % 10);
+        *--p = (char)('0' + (negative ? -digit : digit));
+        value /= 10;
+    } while (value != 0);
+    if (negative) {
+        *--p = '-';
     }
-    if (input_strs) {
-        for (unsigned int i = 0; i < hits; i++) {
-            free(input_strs[i]);
+    printf("%s%s\n", label, p);
+}
+
+// Usage: 2.out [-c] [-j threads]
+//  -c: cache the parsed input in input.bin, see read_input_enable_cache
+//  -j: nr of threads to read and solve with (default: nr of CPUs)
+int main(int argc, char **argv)
+{
+    long nr_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            read_input_enable_cache();
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nr_of_threads = atol(argv[++arg]);
+        } else {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
         }
-        free(input_strs);
     }
+    nr_of_threads = nr_of_threads < 1 ? 1 : nr_of_threads > MAX_THREADS ? MAX_THREADS : nr_of_threads;
+    read_input_set_threads((unsigned int)nr_of_threads);
+
+    table input;
+    if (read_table("input", SCHEMA, &input) != 0) {
+        return 0;
+    }
+    const uint8_t *commands = input.columns[0].codes;
+    const int *values = input.columns[1].ints;
+    size_t nr_of_commands = input.nr_of_records;
+
+    block blocks[MAX_THREADS];
+    unsigned int nr_of_blocks = (unsigned int)nr_of_threads;
+    if (nr_of_blocks > nr_of_commands / MIN_BLOCK) {
+        nr_of_blocks = nr_of_commands / MIN_BLOCK > 0 ? (unsigned int)(nr_of_commands / MIN_BLOCK) : 1;
+    }
+    for (unsigned int i = 0; i < nr_of_blocks; i++) {
+        size_t start = nr_of_commands / nr_of_blocks * i;
+        size_t end = i + 1 < nr_of_blocks ? nr_of_commands / nr_of_blocks * (i + 1) : nr_of_commands;
+        blocks[i].commands = commands + start;
+        blocks[i].values = values + start;
+        blocks[i].nr_of_commands = end - start;
+    }
+    solve_blocks(blocks, nr_of_blocks);
+
+    /* part 1 */
+    long long pos_x = 0, pos_y = 0;
+    for (unsigned int i = 0; i < nr_of_blocks; i++) {
+        pos_x += blocks[i].sums[FORWARD];
+        pos_y += blocks[i].sums[DOWN] - blocks[i].sums[UP];
+    }
+    print_product("i) ", pos_x, pos_y);
+
+    /* part 2 */
+    long long aim = 0;  // "aim", for every forward tick we will also go down by this much
+    int128 depth = 0;
+    for (unsigned int i = 0; i < nr_of_blocks; i++) {
+        depth += blocks[i].depth + (int128)aim * blocks[i].sums[FORWARD];
+        aim += blocks[i].sums[DOWN] - blocks[i].sums[UP];
+    }
+    print_product("ii) ", pos_x, depth);
+
+    free_table(&input);
     return 0;
 }
@@ -1,166 +1,189 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "../read_input.h"
 
-int main()
-{
-    unsigned int *input_string_status = NULL;
+/*
+ * Each line is read as one word of width bits (any width up to 64), where the last digit is the lowest bit.
+ *  part1: the ones of each bit are counted 64 rows at a time: the 64x64 bits of the rows are transposed to
+ *         bit-planes (word 63 - b has bit b of each row), so a popcount of a plane counts the ones of a bit.
+ *         Blocks of rows are counted on threads of their own.
+ *  part2: the rows still matching are kept together, and for each bit they are partitioned into those with
+ *         a one and those with a zero, so the part to keep next is one of these.
+ */
+#define MIN_BLOCK (1 << 16)  // rows, fewer are not worth a thread of their own
+#define MAX_THREADS 64
 
-    unsigned int hits;
-    char **input_strs;
-    if (read_strs("input", &hits, &input_strs) != 0) {
-        goto error;
-    }
-    if (!input_strs) {
-        goto error;
-    }
-
-    /* part 1 */
-    uint16_t gamma_rate = 0, epsilon_rate = 0;
-    uint16_t ones_found_in_column;
+typedef struct {
+    const uint64_t *rows;
+    size_t nr_of_rows;
+    uint64_t ones[64];  // result, per bit
+} block;
 
-    size_t width = strlen(input_strs[0]);
-    if (width != 12) {
-        goto error;
+// transpose 64x64 bits, bit b of a[r] goes to bit 63 - r of a[63 - b] (Hacker's Delight, transpose32 for 64 bits)
+static void transpose64(uint64_t a[64])
+{
+    uint64_t m = 0x00000000FFFFFFFFULL;
+    for (unsigned int j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (unsigned int k = 0; k < 64; k = (k + j + 1) & ~j) {
+            uint64_t t = (a[k] ^ (a[k + j] >> j)) & m;
+            a[k] ^= t;
+            a[k + j] ^= t << j;
+        }
     }
+}
 
-    // for each column (x from 0 to 11), if more than half chars in row (y) are '1'
-    //  set corresponding bit in gamma rate to 1, specifically the bit 2^(11-x).
-    // epsilon rate follows the same logic, but looking for '0' instead,
-    //  since a value may only be one or zero, we simply bit invert gamma rate to get epsilon rate.
-    // NOTE: if a column has the same number of '1' and '0', the result is undefined
-    for (uint16_t x = 0; x < width; x++) {
-        ones_found_in_column = 0;
-        for (uint16_t y = 0; y < hits; y++) {
-            if (input_strs[y][x] == '1') {
-                ones_found_in_column++;
-            }
-            if (ones_found_in_column > hits / 2) {
-                gamma_rate |= (uint16_t)(2048 >> x);  // 2^11 >> x
-                break;
-            }
+static void *count_block(void *arg)
+{
+    block *b = arg;
+    uint64_t planes[64];
+    memset(b->ones, 0, sizeof(b->ones));
+    for (size_t y = 0; y < b->nr_of_rows; y += 64) {
+        size_t n = b->nr_of_rows - y < 64 ? b->nr_of_rows - y : 64;
+        memcpy(planes, b->rows + y, n * sizeof(uint64_t));
+        memset(planes + n, 0, (64 - n) * sizeof(uint64_t));  // (rows of zeros add no ones)
+        transpose64(planes);
+        for (unsigned int bit = 0; bit < 64; bit++) {
+            b->ones[bit] += (uint64_t)__builtin_popcountll(planes[63 - bit]);
         }
     }
+    return NULL;
+}
 
-    epsilon_rate = gamma_rate ^ (4096 - 1);  // invert the data bits (12 low bits: 4096-1 = 2^12-1)
-    printf("i) %d*%d = %d\n", gamma_rate, epsilon_rate, gamma_rate * epsilon_rate);
-
-    /* part 2 */
-    enum status { UNSET = 0, OXYGEN, SCRUBBER, NONE };
-    input_string_status = calloc(hits, sizeof(unsigned int));
-    unsigned int oxygen_strs_matching = hits;
-    unsigned int scrubber_strs_matching = hits;
-
-    uint16_t zeroes_oxygen = 0, ones_oxygen = 0;
-    uint16_t zeroes_scrubber = 0, ones_scrubber = 0;
-    uint16_t oxygen_rating = 0, scrubber_rating = 0;
-    char *scrubber_str = NULL, *oxygen_str = NULL;
-    char oxygen_last_char, scrubber_last_char, actual_last_char;
-    for (uint16_t x = 0; x < width; x++) {
-        zeroes_oxygen = 0;
-        ones_oxygen = 0;
-        zeroes_scrubber = 0;
-        ones_scrubber = 0;
-
-        for (uint16_t y = 0; y < hits; y++) {
-            if (input_string_status[y] == NONE) {
-                continue;
-            }
-            // remove lines not matching previous runs result for oxygen and scrubber
-            if (x > 0) {
-                // TODO well I guess this might fail for certain input since we don't check the last iteration this way
-                // (only x-1)
-                actual_last_char = input_strs[y][x - 1];
-
-                // line is ok first time, set line status
-                if (input_string_status[y] == UNSET) {
-                    if (actual_last_char == oxygen_last_char) {
-                        input_string_status[y] = OXYGEN;
-                        oxygen_str = input_strs[y];
-                        scrubber_strs_matching--;
-                    } else if (actual_last_char == scrubber_last_char) {
-                        input_string_status[y] = SCRUBBER;
-                        scrubber_str = input_strs[y];
-                        oxygen_strs_matching--;
-                    }
-                    // line is still OK
-                } else if (actual_last_char == oxygen_last_char && input_string_status[y] == OXYGEN) {
-                    oxygen_str = input_strs[y];
-                } else if (actual_last_char == scrubber_last_char && input_string_status[y] == SCRUBBER) {
-                    scrubber_str = input_strs[y];
-                    // remove line
-                } else {
-                    if (input_string_status[y] == OXYGEN && oxygen_strs_matching > 1) {
-                        oxygen_strs_matching--;
-                        input_string_status[y] = NONE;
-                    } else if (input_string_status[y] == SCRUBBER && scrubber_strs_matching > 1) {
-                        scrubber_strs_matching--;
-                        input_string_status[y] = NONE;
-                    }
-                    continue;
-                }
-            }
+// count ones of each bit of the rows in blocks, on threads of their own
+static void count_ones(const uint64_t *rows, size_t nr_of_rows, unsigned int nr_of_threads, uint64_t ones[64])
+{
+    block blocks[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    unsigned int nr_of_blocks = nr_of_threads;
+    if (nr_of_blocks > nr_of_rows / MIN_BLOCK) {
+        nr_of_blocks = nr_of_rows / MIN_BLOCK > 0 ? (unsigned int)(nr_of_rows / MIN_BLOCK) : 1;
+    }
+    for (unsigned int i = 0; i < nr_of_blocks; i++) {
+        size_t start = nr_of_rows / nr_of_blocks * i;
+        size_t end = i + 1 < nr_of_blocks ? nr_of_rows / nr_of_blocks * (i + 1) : nr_of_rows;
+        blocks[i].rows = rows + start;
+        blocks[i].nr_of_rows = end - start;
+    }
 
-            // count zeroes and ones only if still in list
-            if (input_string_status[y] == SCRUBBER || input_string_status[y] == UNSET) {
-                if (input_strs[y][x] == '0') {
-                    zeroes_scrubber++;
-                }
-                if (input_strs[y][x] == '1') {
-                    ones_scrubber++;
-                }
-            }
-            if (input_string_status[y] == OXYGEN || input_string_status[y] == UNSET) {
-                if (input_strs[y][x] == '0') {
-                    zeroes_oxygen++;
-                }
-                if (input_strs[y][x] == '1') {
-                    ones_oxygen++;
-                }
-            }
-        }
-        if (oxygen_strs_matching == 1 && scrubber_strs_matching == 1) {
+    unsigned int started = 1;
+    for (; started < nr_of_blocks; started++) {
+        if (pthread_create(&threads[started], NULL, count_block, &blocks[started]) != 0) {
             break;
         }
+    }
+    count_block(&blocks[0]);
+    for (unsigned int i = started; i < nr_of_blocks; i++) {
+        count_block(&blocks[i]);  // (could not start a thread)
+    }
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
 
-        if (ones_oxygen >= zeroes_oxygen) {
-            oxygen_last_char = '1';
-        } else if (zeroes_oxygen > ones_oxygen) {
-            oxygen_last_char = '0';
-        }
-        if (ones_scrubber >= zeroes_scrubber) {
-            scrubber_last_char = '0';
-        } else if (zeroes_scrubber > ones_scrubber) {
-            scrubber_last_char = '1';
+    memset(ones, 0, 64 * sizeof(uint64_t));
+    for (unsigned int i = 0; i < nr_of_blocks; i++) {
+        for (unsigned int bit = 0; bit < 64; bit++) {
+            ones[bit] += blocks[i].ones[bit];
         }
     }
+}
 
-    // binary string to int
-    uint16_t i = 1;
-    for (int x = 11; x >= 0; x--) {
-        if (scrubber_str[x] == '1') {
-            scrubber_rating |= i;
+// the row left when keeping rows with the most common value of each bit (1 if equally common),
+//  or the least common (0 if equally common). Reorders rows
+static uint64_t rating(uint64_t *rows, size_t nr_of_rows, unsigned int width, bool most_common)
+{
+    for (unsigned int bit = width; bit-- > 0 && nr_of_rows > 1;) {
+        // ones first
+        size_t ones = 0;
+        for (size_t y = 0; y < nr_of_rows; y++) {
+            if ((rows[y] >> bit) & 1) {
+                uint64_t row = rows[y];
+                rows[y] = rows[ones];
+                rows[ones++] = row;
+            }
         }
-        if (oxygen_str[x] == '1') {
-            oxygen_rating |= i;
+        size_t zeroes = nr_of_rows - ones;
+        bool keep_ones = most_common ? ones >= zeroes : ones < zeroes;
+        if ((keep_ones && ones > 0) || zeroes == 0) {
+            nr_of_rows = ones;
+        } else {
+            rows += ones;
+            nr_of_rows = zeroes;
         }
-        i = (uint16_t)(i << 1);
     }
+    return rows[0];
+}
 
-    printf("ii) %d*%d = %d\n", oxygen_rating, scrubber_rating, oxygen_rating * scrubber_rating);
+// Usage: 3.out [-c] [-j threads]
+//  -c: cache the parsed input in input.bin, see read_input_enable_cache
+//  -j: nr of threads to read and count with (default: nr of CPUs)
+int main(int argc, char **argv)
+{
+    long nr_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            read_input_enable_cache();
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nr_of_threads = atol(argv[++arg]);
+        } else {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+    }
+    nr_of_threads = nr_of_threads < 1 ? 1 : nr_of_threads > MAX_THREADS ? MAX_THREADS : nr_of_threads;
+    read_input_set_threads((unsigned int)nr_of_threads);
+    uint64_t *rows = NULL;
 
-error:
-    if (input_string_status) {
-        free(input_string_status);
+    // each line as one word (of width bits)
+    table input;
+    if (read_table("input", "bitstring", &input) != 0) {
+        return 0;
+    }
+    const column *diagnostics = &input.columns[0];
+    size_t hits = input.nr_of_records;
+    unsigned int width = diagnostics->width;
+    if (hits == 0) {
+        goto error;
     }
-    if (input_strs) {
-        for (unsigned int i = 0; i < hits; i++) {
-            free(input_strs[i]);
+
+    /* part 1 */
+    // gamma rate has the bits which are 1 in more than half of the rows,
+    //  epsilon rate follows the same logic, but looking for 0 instead,
+    //  since a value may only be one or zero, we simply bit invert gamma rate to get epsilon rate.
+    // NOTE: if a bit has the same number of 1 and 0, the result is undefined
+    uint64_t ones[64];
+    uint64_t gamma_rate = 0, epsilon_rate;
+    uint64_t mask = width == 64 ? UINT64_MAX : (UINT64_C(1) << width) - 1;
+    count_ones(diagnostics->bits, hits, (unsigned int)nr_of_threads, ones);
+    for (unsigned int bit = 0; bit < width; bit++) {
+        if (ones[bit] > hits / 2) {
+            gamma_rate |= UINT64_C(1) << bit;
         }
-        free(input_strs);
     }
+    epsilon_rate = gamma_rate ^ mask;  // invert the width data bits
+    // (the product wraps around for more than 32 bits)
+    printf("i) %llu*%llu = %llu\n", (unsigned long long)gamma_rate, (unsigned long long)epsilon_rate,
+           (unsigned long long)(gamma_rate * epsilon_rate));
+
+    /* part 2 */
+    rows = malloc(hits * sizeof(uint64_t));
+    if (!rows) {
+        goto error;
+    }
+    memcpy(rows, diagnostics->bits, hits * sizeof(uint64_t));
+    uint64_t oxygen_rating = rating(rows, hits, width, true);
+    memcpy(rows, diagnostics->bits, hits * sizeof(uint64_t));
+    uint64_t scrubber_rating = rating(rows, hits, width, false);
+
+    printf("ii) %llu*%llu = %llu\n", (unsigned long long)oxygen_rating, (unsigned long long)scrubber_rating,
+           (unsigned long long)(oxygen_rating * scrubber_rating));
+
+error:
+    free(rows);
+    free_table(&input);
     return 0;
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "../read_input.h"
 
 typedef struct {
@@ -102,39 +103,54 @@ static int get_score(board *board, int *draws, unsigned int draw_count)
     return sum_of_unmarked_numbers * draws[draw_count - 1];
 }
 
-int main()
+// Usage: 4.out [-c] [-j threads]
+//  -c: cache the parsed input in input.bin, see read_input_enable_cache
+//  -j: nr of threads to read with (default: nr of CPUs)
+int main(int argc, char **argv)
 {
-    unsigned int lines_in_raw_input;
-    line_entry *input_ints;
-    if (read_ints_per_line("input", &lines_in_raw_input, &input_ints) != 0) {
-        goto error;
+    long nr_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            read_input_enable_cache();
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            nr_of_threads = atol(argv[++arg]);
+        } else {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
     }
-    if (!input_ints) {
+    nr_of_threads = nr_of_threads < 1 ? 1 : nr_of_threads > READ_INPUT_MAX_THREADS ? READ_INPUT_MAX_THREADS
+                                                                                      : nr_of_threads;
+    read_input_set_threads((unsigned int)nr_of_threads);
+    board *boards = NULL;
+    int_lines input_ints;
+    if (read_ints_per_line("input", &input_ints) != 0) {
         goto error;
     }
+    unsigned int lines_in_raw_input = input_ints.nr_of_lines;
 
     /* part 1 & 2 */
     board *winner = NULL;       // part 1
     int last_winner_score = 0;  // part 2
 
-    int *drawn_numbers = input_ints[0].elems;  // first line must be drawn numbers
-    unsigned int drawn_numbers_count = input_ints[0].nr_elems;
+    int *drawn_numbers = line_ints(&input_ints, 0);  // first line must be drawn numbers
+    unsigned int drawn_numbers_count = (unsigned int)line_length(&input_ints, 0);
 
     // Find and assign boards,
     //  a board is 5 consecutive rows with exactly 5 integers in each.
     unsigned int nr_of_boards = lines_in_raw_input / 5;  // theoretical max nr of boards
-    board *boards = calloc(nr_of_boards, sizeof(board));
+    boards = calloc(nr_of_boards, sizeof(board));
     unsigned int rows_found = 1, nr_of_boards_found = 0;
     for (unsigned int cur_line = 1; cur_line < lines_in_raw_input; cur_line++) {
         // invalid row, reset board
-        if (input_ints[cur_line].nr_elems != 5) {
+        if (line_length(&input_ints, cur_line) != 5) {
             rows_found = 1;
             // board completed, fill board
         } else if (rows_found == 5) {
             for (unsigned int row = 0; row < 5; row++) {
                 for (unsigned int col = 0; col < 5; col++) {
                     unsigned int start_of_board = cur_line - 4;
-                    int current_num = input_ints[start_of_board + row].elems[col];
+                    int current_num = line_ints(&input_ints, start_of_board + row)[col];
 
                     boards[nr_of_boards_found].numbers[row][col] = current_num;
                 }
@@ -192,11 +208,6 @@ error:
     if (boards) {
         free(boards);
     }
-    if (input_ints) {
-        for (unsigned int i = 0; i < lines_in_raw_input; i++) {
-            free(input_ints[i].elems);
-        }
-        free(input_ints);
-    }
+    free_int_lines(&input_ints);
     return 0;
 }
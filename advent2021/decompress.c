@@ -0,0 +1,150 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "decompress.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+struct decompressor {
+    enum compression compression;
+    bool in_stream;  // started on a stream which has not ended yet
+#ifdef HAVE_ZLIB
+    z_stream gzip;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+enum compression compression_of(const void *start, size_t length)
+{
+    const unsigned char *magic = start;
+    if (length >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return COMPRESSION_GZIP;
+    }
+    if (length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+const char *compression_name(enum compression compression)
+{
+    switch (compression) {
+        case COMPRESSION_GZIP:
+            return "gzip";
+        case COMPRESSION_ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
+
+decompressor *decompressor_start(enum compression compression)
+{
+    decompressor *d = calloc(1, sizeof(decompressor));
+    if (!d) {
+        return NULL;
+    }
+    d->compression = compression;
+    switch (compression) {
+#ifdef HAVE_ZLIB
+        case COMPRESSION_GZIP:
+            if (inflateInit2(&d->gzip, 16 + MAX_WBITS) == Z_OK) {  // (16: gzip header, not zlib)
+                return d;
+            }
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            d->zstd = ZSTD_createDStream();
+            if (d->zstd && !ZSTD_isError(ZSTD_initDStream(d->zstd))) {
+                return d;
+            }
+            ZSTD_freeDStream(d->zstd);
+            break;
+#endif
+        default:
+            break;
+    }
+    free(d);
+    return NULL;
+}
+
+void decompressor_stop(decompressor *d)
+{
+    if (!d) {
+        return;
+    }
+#ifdef HAVE_ZLIB
+    if (d->compression == COMPRESSION_GZIP) {
+        inflateEnd(&d->gzip);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (d->compression == COMPRESSION_ZSTD) {
+        ZSTD_freeDStream(d->zstd);
+    }
+#endif
+    free(d);
+}
+
+ssize_t decompress(decompressor *d, const char **in, const char *in_end, char *out, size_t out_size)
+{
+    size_t in_size = (size_t)(in_end - *in);
+    if (out_size > SSIZE_MAX) {
+        out_size = SSIZE_MAX;
+    }
+    if (in_size > 0) {
+        d->in_stream = true;
+    }
+    switch (d->compression) {
+#ifdef HAVE_ZLIB
+        case COMPRESSION_GZIP: {
+            // (sizes are given as unsigned int to zlib, whatever does not fit is done next time)
+            d->gzip.next_in = (Bytef *)(uintptr_t)*in;
+            d->gzip.avail_in = in_size < UINT_MAX ? (unsigned int)in_size : UINT_MAX;
+            d->gzip.next_out = (Bytef *)out;
+            d->gzip.avail_out = out_size < UINT_MAX ? (unsigned int)out_size : UINT_MAX;
+            int rv = inflate(&d->gzip, Z_NO_FLUSH);
+            if (rv == Z_STREAM_END) {
+                // the next stream (gzip member) starts right after, if there is one
+                d->in_stream = false;
+                if (inflateReset(&d->gzip) != Z_OK) {
+                    return -1;
+                }
+            } else if (rv != Z_OK && !(rv == Z_BUF_ERROR && d->gzip.avail_in == 0)) {
+                return -1;
+            }
+            *in = (const char *)d->gzip.next_in;
+            return (ssize_t)((char *)d->gzip.next_out - out);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD: {
+            ZSTD_inBuffer input = {*in, in_size, 0};
+            ZSTD_outBuffer output = {out, out_size, 0};
+            size_t rv = ZSTD_decompressStream(d->zstd, &output, &input);
+            if (ZSTD_isError(rv)) {
+                return -1;
+            }
+            d->in_stream = rv != 0;  // (0 when a frame is done)
+            *in += input.pos;
+            return (ssize_t)output.pos;
+        }
+#endif
+        default:
+            (void)out;  // (not supported by this build, as decompressor_start tells)
+            return -1;
+    }
+}
+
+bool decompressor_finished(const decompressor *d)
+{
+    return !d->in_stream;
+}
@@ -0,0 +1,29 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Decompress gzip (with zlib, HAVE_ZLIB) and zstd (with libzstd, HAVE_ZSTD) a part at a time, in memory.
+ *  Whichever of the libraries is found is used when building (see CMakeLists.txt).
+ */
+enum compression { COMPRESSION_NONE, COMPRESSION_GZIP, COMPRESSION_ZSTD };
+
+// compression of data which starts with start (found by its magic bytes, so length should be at least 4)
+enum compression compression_of(const void *start, size_t length);
+const char *compression_name(enum compression);
+
+typedef struct decompressor decompressor;
+
+// NULL if the compression is not supported by this build (or out of memory)
+decompressor *decompressor_start(enum compression);
+void decompressor_stop(decompressor *);
+// decompress from *in (moved past what is used) to out, returns nr of bytes written to out or -1 on invalid data.
+//  The data may be a few compressed streams (files) after each other.
+ssize_t decompress(decompressor *, const char **in, const char *in_end, char *out, size_t out_size);
+// true if all data given is decompressed, and it ended with the end of a stream (i.e. it was not cut short)
+bool decompressor_finished(const decompressor *);
+
+#endif
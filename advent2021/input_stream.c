@@ -0,0 +1,363 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "input_stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "decompress.h"
+#include "parse_int.h"
+#include "read_ahead.h"
+
+struct input_stream {
+    int fd;
+    read_ahead *ahead;  // NULL if it could not be started (then fd is read as needed)
+    double opened;      // time
+    double io_wait;     // seconds
+    bool eof;   // everything is read from fd
+    bool done;  // found something which is not a value, so there are no more values
+    off_t offset;  // in the file, of the start of buffer
+    off_t end;     // values which start here or later are in the next part, -1 if there is none
+    size_t pos;
+    size_t length;
+    char buffer[INPUT_STREAM_BUFFER_SIZE];
+};
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_str_char(char c)
+{
+    return !is_space(c);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void input_stream_close(input_stream *s)
+{
+    if (!s) {
+        return;
+    }
+    read_ahead_stop(s->ahead);
+    if (s->fd != STDIN_FILENO) {
+        close(s->fd);
+    }
+    free(s);
+}
+
+// move what is left to the start of the buffer and read more, returns 0 on success (also at end of file)
+static int refill(input_stream *s)
+{
+    if (s->eof) {
+        return 0;
+    }
+    memmove(s->buffer, s->buffer + s->pos, s->length - s->pos);
+    s->offset += (off_t)s->pos;
+    s->length -= s->pos;
+    s->pos = 0;
+    if (s->length == sizeof(s->buffer)) {
+        return 1;  // one value does not fit in the buffer
+    }
+
+    ssize_t nr_read;
+    double start = now();
+    if (s->ahead) {
+        nr_read = read_ahead_read(s->ahead, s->buffer + s->length, sizeof(s->buffer) - s->length);
+    } else {
+        do {
+            nr_read = read(s->fd, s->buffer + s->length, sizeof(s->buffer) - s->length);
+        } while (nr_read < 0 && errno == EINTR);
+    }
+    s->io_wait += now() - start;
+    if (nr_read < 0) {
+        return 1;
+    }
+    s->eof = nr_read == 0;
+    s->length += (size_t)nr_read;
+    return 0;
+}
+
+// skip whitespace (up to newline if stop_at_newline), returns INPUT_STREAM_END if there is nothing else
+static enum input_stream_result skip_space(input_stream *s, bool stop_at_newline)
+{
+    while (1) {
+        while (s->pos < s->length && is_space(s->buffer[s->pos]) && !(stop_at_newline && s->buffer[s->pos] == '\n')) {
+            s->pos++;
+        }
+        if (s->pos < s->length) {
+            return INPUT_STREAM_OK;
+        }
+        if (s->eof) {
+            return INPUT_STREAM_END;
+        }
+        if (refill(s) != 0) {
+            return INPUT_STREAM_ERROR;
+        }
+    }
+}
+
+// read until the whole token (chars for which in_token is true) at pos is in the buffer, returns 0 on success
+static int load_token(input_stream *s, bool (*in_token)(char), size_t *length)
+{
+    size_t i = s->pos;
+    while (1) {
+        while (i < s->length && in_token(s->buffer[i])) {
+            i++;
+        }
+        if (i < s->length || s->eof) {
+            *length = i - s->pos;
+            return 0;
+        }
+        size_t scanned = i - s->pos;
+        if (refill(s) != 0) {
+            return 1;
+        }
+        i = s->pos + scanned;
+    }
+}
+
+// read int at pos, which is not whitespace
+static enum input_stream_result read_int(input_stream *s, int *value)
+{
+    while (1) {
+        const char *p = s->buffer + s->pos, *end = s->buffer + s->length;
+        enum parse_int_result rv = parse_int(&p, end, value);
+        // the int (or a sign) may continue after what is read so far
+        bool cut = rv == PARSE_INT_NONE ? end - p == 1 : p == end;
+        if (cut && !s->eof) {
+            if (refill(s) != 0) {
+                return INPUT_STREAM_ERROR;
+            }
+            continue;
+        }
+        switch (rv) {
+            case PARSE_INT_OK:
+                s->pos = (size_t)(p - s->buffer);
+                return INPUT_STREAM_OK;
+            case PARSE_INT_NONE:
+                s->done = true;
+                return INPUT_STREAM_END;
+            default:
+                return INPUT_STREAM_ERROR;
+        }
+    }
+}
+
+// open fd for the values which start in [start, end) of the file (end -1: to the end of the file)
+static input_stream *stream_open(int fd, off_t start, off_t end)
+{
+    input_stream *s = malloc(sizeof(input_stream));
+    if (!s) {
+        return NULL;
+    }
+    s->fd = fd;
+    s->eof = false;
+    s->done = false;
+    s->offset = start > 0 ? start - 1 : 0;
+    s->end = end;
+    s->pos = 0;
+    s->length = 0;
+    s->io_wait = 0;
+    if (start > 0 && lseek(fd, s->offset, SEEK_SET) < 0) {
+        free(s);
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);  // (fails for pipes, which is fine)
+    s->ahead = read_ahead_start(fd, sizeof(s->buffer));
+    s->opened = now();
+
+    // a value which goes on at start is in the previous part, so the part starts after the first whitespace
+    size_t length;
+    if (start > 0 && load_token(s, is_str_char, &length) != 0) {
+        read_ahead_stop(s->ahead);
+        free(s);
+        return NULL;
+    }
+    if (start > 0) {
+        s->pos = length;
+    }
+    return s;
+}
+
+input_stream *input_stream_open(const char *file_name)
+{
+    if (!file_name) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    int fd = strcmp(file_name, "-") == 0 ? STDIN_FILENO : open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    input_stream *s = stream_open(fd, 0, -1);
+    if (!s && fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return s;
+}
+
+static bool compressed(int fd)
+{
+    char magic[4];
+    ssize_t length = pread(fd, magic, sizeof(magic), 0);
+    return compression_of(magic, length > 0 ? (size_t)length : 0) != COMPRESSION_NONE;
+}
+
+input_stream *input_stream_open_part(const char *file_name, unsigned int part, unsigned int nr_of_parts)
+{
+    if (!file_name || part >= nr_of_parts) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    int fd = strcmp(file_name, "-") == 0 ? STDIN_FILENO : open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // only a (not compressed) file can be split, otherwise the first part is all of it
+    struct stat st;
+    off_t start = 0, end = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && !compressed(fd)) {
+        off_t size = st.st_size, parts = size / INPUT_STREAM_MIN_PART > 0 ? size / INPUT_STREAM_MIN_PART : 1;
+        parts = parts < nr_of_parts ? parts : nr_of_parts;
+        start = part < parts ? size / parts * part : size;
+        end = part + 1 < parts ? size / parts * (part + 1) : size;
+    } else if (part > 0) {
+        start = end = 0;
+    }
+    if (start == end) {
+        // nothing to read (and fd, which may be stdin, is not read from)
+        input_stream *s = calloc(1, sizeof(input_stream));
+        if (s) {
+            s->fd = fd;
+            s->eof = true;
+            s->end = end;
+            s->opened = now();
+        } else if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return s;
+    }
+    input_stream *s = stream_open(fd, start, end);
+    if (!s && fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return s;
+}
+
+enum input_stream_result input_stream_next_int(input_stream *s, int *value)
+{
+    if (!s || !value) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    if (s->done) {
+        return INPUT_STREAM_END;
+    }
+    enum input_stream_result rv = skip_space(s, false);
+    if (rv == INPUT_STREAM_OK && s->end >= 0 && s->offset + (off_t)s->pos >= s->end) {
+        return INPUT_STREAM_END;  // the next value is in the next part
+    }
+    return rv == INPUT_STREAM_OK ? read_int(s, value) : rv;
+}
+
+enum input_stream_result input_stream_next_line_ints(input_stream *s, int *ints, size_t max_ints, size_t *nr_of_ints)
+{
+    size_t nr = 0;
+    if (!s || !ints || !nr_of_ints) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    *nr_of_ints = 0;
+    if (s->done) {
+        return INPUT_STREAM_END;
+    }
+    enum input_stream_result rv = skip_space(s, false);
+    while (rv == INPUT_STREAM_OK) {
+        if (nr == max_ints) {
+            return INPUT_STREAM_ERROR;
+        }
+        rv = read_int(s, &ints[nr]);
+        if (rv != INPUT_STREAM_OK) {
+            break;
+        }
+        nr++;
+
+        // separator, then the next int is on the same line unless there is a newline before it
+        if (s->pos == s->length && refill(s) != 0) {
+            return INPUT_STREAM_ERROR;
+        }
+        if (s->pos == s->length || s->buffer[s->pos++] == '\n') {
+            break;
+        }
+        rv = skip_space(s, true);
+        if (rv == INPUT_STREAM_OK && s->buffer[s->pos] == '\n') {
+            s->pos++;
+            break;
+        }
+    }
+    if (rv == INPUT_STREAM_ERROR) {
+        return rv;
+    }
+    *nr_of_ints = nr;
+    return nr ? INPUT_STREAM_OK : INPUT_STREAM_END;
+}
+
+enum input_stream_result input_stream_next_str_int(input_stream *s, char *str, size_t str_size, int *value)
+{
+    size_t length;
+    if (!s || !str || !value) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    if (s->done) {
+        return INPUT_STREAM_END;
+    }
+    enum input_stream_result rv = skip_space(s, false);
+    if (rv != INPUT_STREAM_OK) {
+        return rv;
+    }
+    if (load_token(s, is_str_char, &length) != 0 || length >= str_size) {
+        return INPUT_STREAM_ERROR;
+    }
+    memcpy(str, s->buffer + s->pos, length);
+    str[length] = '\0';
+    s->pos += length;
+
+    rv = skip_space(s, false);
+    if (rv == INPUT_STREAM_END) {
+        s->done = true;  // string without int
+    }
+    return rv == INPUT_STREAM_OK ? read_int(s, value) : rv;
+}
+
+bool input_stream_stopped(const input_stream *s)
+{
+    if (!s) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    return s->done;
+}
+
+void input_stream_times(const input_stream *s, double *io_wait, double *other, const char **read_ahead)
+{
+    if (!s || !io_wait || !other || !read_ahead) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    *io_wait = s->io_wait;
+    *other = now() - s->opened - s->io_wait;
+    *read_ahead = s->ahead ? read_ahead_method(s->ahead) : "none";
+}
@@ -0,0 +1,46 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef INPUT_STREAM_H
+#define INPUT_STREAM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Read values one at a time from a file, a pipe, or stdin (file name "-"),
+ *  through a fixed-size buffer which is refilled as needed (so memory use does not depend on input size).
+ * The values are found as by the readers in read_input.h, so these stop at the first thing which is not a value.
+ * The next part of the file is read while the current one is parsed, see read_ahead.h.
+ */
+#ifndef INPUT_STREAM_BUFFER_SIZE
+#define INPUT_STREAM_BUFFER_SIZE (1 << 16)  // also the max length of one value
+#endif
+#ifndef INPUT_STREAM_MIN_PART
+#define INPUT_STREAM_MIN_PART (1 << 20)  // a smaller part of a file is not worth a thread of its own
+#endif
+
+typedef struct input_stream input_stream;
+enum input_stream_result { INPUT_STREAM_OK = 0, INPUT_STREAM_END, INPUT_STREAM_ERROR };
+
+input_stream *input_stream_open(const char *file_name);
+// Part of a file, to read the parts on threads of their own: the values (as input_stream_next_int) which start
+//  in the byte range [size / nr_of_parts * part, size / nr_of_parts * (part + 1)). Parts are at least
+//  INPUT_STREAM_MIN_PART bytes (so for a smaller file only the first parts have values), and a pipe or
+//  compressed file is not split (all of it is the first part).
+input_stream *input_stream_open_part(const char *file_name, unsigned int part, unsigned int nr_of_parts);
+void input_stream_close(input_stream *);
+
+// The functions below return INPUT_STREAM_END when there are no more values,
+//  and INPUT_STREAM_ERROR on read error or invalid value (int too large, string or line too long).
+enum input_stream_result input_stream_next_int(input_stream *, int *value);
+// Ints of the next line with any ints (as read_ints_per_line), at most max_ints
+enum input_stream_result input_stream_next_line_ints(input_stream *, int *ints, size_t max_ints, size_t *nr_of_ints);
+// String followed by an int (as read_str_int), the string including '\0' is at most str_size chars
+enum input_stream_result input_stream_next_str_int(input_stream *, char *str, size_t str_size, int *value);
+
+// true if the values ended at something which is not a value (not at the end of the file, or part)
+bool input_stream_stopped(const input_stream *);
+
+// Time since the stream was opened spent waiting for reads, and on everything else (parsing, and whatever
+//  the caller does between values), in seconds. read_ahead is how reads are done ahead, see read_ahead_method.
+void input_stream_times(const input_stream *, double *io_wait, double *other, const char **read_ahead);
+
+#endif
@@ -0,0 +1,182 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "parse_int.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Integer parsing for the readers (see read_input.c), instead of fscanf.
+ *  Runs of digits are found 32 (AVX2) or 16 (SSE2) bytes at a time, and up to 8 digits are converted at once
+ *  within a 64-bit word (SWAR). Near the end of the buffer, and without SSE2, this is done one byte at a time.
+ *  Binary digits (bitstrings) are found the same way, and the lowest bit of each byte is its value,
+ *  so movemask gives the value of 32 (or 16) digits at once.
+ */
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+size_t digit_run(const char *p, const char *end)
+{
+    const char *start = p;
+#if defined(__AVX2__)
+    // c is a digit if (c - '0') < 10 unsigned, which is (c - '0') ^ 0x80 < -118 signed
+    const __m256i zero = _mm256_set1_epi8('0'), flip = _mm256_set1_epi8((char)0x80), limit = _mm256_set1_epi8(-118);
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_xor_si256(_mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(const void *)p), zero),
+                                         flip);
+        uint32_t not_digits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, chunk));
+        if (not_digits) {
+            return (size_t)(p - start) + (size_t)__builtin_ctz(not_digits);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_set1_epi8('0'), flip = _mm_set1_epi8((char)0x80), limit = _mm_set1_epi8(-118);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_xor_si128(_mm_sub_epi8(_mm_loadu_si128((const __m128i *)(const void *)p), zero), flip);
+        unsigned int not_digits = ~(unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(chunk, limit)) & 0xffff;
+        if (not_digits) {
+            return (size_t)(p - start) + (size_t)__builtin_ctz(not_digits);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && is_digit(*p)) {
+        p++;
+    }
+    return (size_t)(p - start);
+}
+
+// bits in reverse order
+static uint32_t reverse_bits(uint32_t x)
+{
+    x = (x >> 1 & 0x55555555U) | (x & 0x55555555U) << 1;
+    x = (x >> 2 & 0x33333333U) | (x & 0x33333333U) << 2;
+    x = (x >> 4 & 0x0F0F0F0FU) | (x & 0x0F0F0F0FU) << 4;
+    return __builtin_bswap32(x);
+}
+
+// value followed by the first length (at most 32) of the digits in ones, where the first digit is the lowest bit
+static uint64_t append_bits(uint64_t value, uint32_t ones, size_t length)
+{
+    if (length == 0) {
+        return value;
+    }
+    return value << length | reverse_bits(ones) >> (32 - length);
+}
+
+size_t binary_run(const char *p, const char *end, uint64_t *out)
+{
+    const char *start = p;
+    uint64_t value = 0;
+#if defined(__AVX2__)
+    // c is a binary digit if (c & ~1) == '0', and its value is the lowest bit (moved to the highest for movemask)
+    const __m256i zero = _mm256_set1_epi8('0'), not_one = _mm256_set1_epi8((char)0xFE);
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(const void *)p);
+        uint32_t binary = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(chunk, not_one), zero));
+        uint32_t ones = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(chunk, 7));
+        size_t length = ~binary ? (size_t)__builtin_ctz(~binary) : 32;
+        value = append_bits(value, ones, length);
+        p += length;
+        if (length < 32) {
+            *out = value;
+            return (size_t)(p - start);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_set1_epi8('0'), not_one = _mm_set1_epi8((char)0xFE);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)p);
+        uint32_t binary = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(chunk, not_one), zero));
+        uint32_t ones = (uint32_t)_mm_movemask_epi8(_mm_slli_epi64(chunk, 7));
+        size_t length = binary != 0xffff ? (size_t)__builtin_ctz(~binary) : 16;
+        value = append_bits(value, ones, length);
+        p += length;
+        if (length < 16) {
+            *out = value;
+            return (size_t)(p - start);
+        }
+    }
+#endif
+    while (p < end && (*p == '0' || *p == '1')) {
+        value = value << 1 | (uint64_t)(*p++ - '0');
+    }
+    *out = value;
+    return (size_t)(p - start);
+}
+
+// value of 8 digits in one little-endian word, the first digit is the lowest byte
+static uint32_t swar_value(uint64_t digits)
+{
+    digits = ((digits & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    digits = ((digits & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (uint32_t)(((digits & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+// value of length (at most 8) digits at p, reads 8 bytes from p if there is room
+static uint32_t digits_value(const char *p, size_t length, const char *end)
+{
+    uint32_t value = 0;
+    if (end - p >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        // the bytes after the digits are shifted out, the subtraction only borrows from them (i.e. later bytes)
+        return swar_value((word - 0x3030303030303030ULL) << (8 * (8 - length)));
+    }
+    for (size_t i = 0; i < length; i++) {
+        value = value * 10 + (uint32_t)(p[i] - '0');
+    }
+    return value;
+}
+
+enum parse_int_result parse_int(const char **pos, const char *end, int *out)
+{
+    const char *p = *pos;
+    bool negative = false;
+
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    size_t length = digit_run(p, end);
+    if (length == 0) {
+        return PARSE_INT_NONE;
+    }
+    const char *digits = p;
+    *pos = p + length;
+    while (length > 1 && *digits == '0') {
+        digits++;
+        length--;
+    }
+    if (length > 10) {
+        return PARSE_INT_OVERFLOW;
+    }
+
+    uint64_t value;
+    if (length <= 8) {
+        value = digits_value(digits, length, end);
+    } else {
+        value = (uint64_t)digits_value(digits, length - 8, end) * 100000000 +
+                digits_value(digits + length - 8, 8, end);
+    }
+    if (value > (uint64_t)INT_MAX + negative) {
+        return PARSE_INT_OVERFLOW;
+    }
+    *out = negative ? (int)(-(int64_t)value) : (int)value;
+    return PARSE_INT_OK;
+}
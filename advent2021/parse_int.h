@@ -0,0 +1,17 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef PARSE_INT_H
+#define PARSE_INT_H
+#include <stddef.h>
+#include <stdint.h>
+
+enum parse_int_result { PARSE_INT_OK = 0, PARSE_INT_NONE, PARSE_INT_OVERFLOW };
+
+// Parse int at *pos as fscanf's %d (whitespace, optional sign, digits), but without locale and with exact overflow
+//  detection. Unless there is no int, *pos is moved past it (also when it does not fit in an int).
+enum parse_int_result parse_int(const char **pos, const char *end, int *out);
+// Number of digits ('0' to '9') at the start of [p, end)
+size_t digit_run(const char *p, const char *end);
+// Number of binary digits ('0' or '1') at the start of [p, end), *out is their value (the lowest 64 bits of it)
+size_t binary_run(const char *p, const char *end, uint64_t *out);
+
+#endif
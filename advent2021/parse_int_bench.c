@@ -0,0 +1,90 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parse_int.h"
+
+/*
+ * Microbenchmark of parse_int against strtol and fscanf("%d")
+ *
+ *  parse_int_bench [nr of ints]   (default 100M)
+ *
+ * The ints are pseudo-random, of different lengths and signs, one per line (as in the inputs).
+ */
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, size_t nr_of_ints, int64_t sum, double seconds)
+{
+    printf("%-10s %zu ints, sum %lld, %.3f s, %.1f M ints/s\n", name, nr_of_ints, (long long)sum, seconds,
+           seconds > 0 ? (double)nr_of_ints / seconds / 1e6 : 0);
+}
+
+int main(int argc, char **argv)
+{
+    size_t nr_of_ints = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000000;
+    size_t size = nr_of_ints * 12 + 1;  // at most 11 chars and newline per int
+    char *text = malloc(size);
+    if (!text || nr_of_ints == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+
+    uint64_t state = 88172645463325252ULL;  // xorshift64
+    size_t length = 0;
+    int64_t expected = 0;
+    for (size_t i = 0; i < nr_of_ints; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int value = (int)(uint32_t)state >> (state >> 59);  // anything from 1 to 10 digits
+        expected += value;
+        length += (size_t)sprintf(text + length, "%d\n", value);
+    }
+    const char *end = text + length;
+    printf("%zu ints, %.1f MB of text\n", nr_of_ints, (double)length / 1e6);
+
+    double start = now_s();
+    int64_t sum = 0;
+    int value;
+    size_t found = 0;
+    for (const char *p = text; parse_int(&p, end, &value) == PARSE_INT_OK; found++) {
+        sum += value;
+    }
+    report("parse_int", found, sum, now_s() - start);
+
+    start = now_s();
+    sum = 0;
+    found = 0;
+    for (char *p = text, *after; p < end; p = after, found++) {
+        sum += strtol(p, &after, 10);
+        if (after == p) {
+            break;
+        }
+    }
+    report("strtol", found, sum, now_s() - start);
+
+    FILE *file = fmemopen(text, length, "r");
+    if (!file) {
+        free(text);
+        return 1;
+    }
+    start = now_s();
+    sum = 0;
+    found = 0;
+    for (; fscanf(file, "%d", &value) == 1; found++) {
+        sum += value;
+    }
+    report("fscanf", found, sum, now_s() - start);
+    fclose(file);
+
+    printf("expected sum %lld\n", (long long)expected);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,462 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "read_ahead.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "decompress.h"
+#if !defined(READ_AHEAD_NO_IO_URING) && defined(SYS_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+/*
+ * Two blocks: the current one, which read_ahead_read copies from, and the other one which is being read into.
+ *  When the current block is used up, we wait for the read of the other, they change places,
+ *  and a read into the used up block is started.
+ * The first block is read when starting, to see from its magic bytes if the input is compressed.
+ */
+enum read_ahead_kind { READ_AHEAD_NONE, READ_AHEAD_IO_URING, READ_AHEAD_THREAD };
+
+struct read_ahead {
+    int fd;
+    enum read_ahead_kind kind;
+    size_t block_size;
+    char *blocks[2];
+    unsigned int current;
+    size_t pos;
+    size_t length;
+    bool reading;  // a read into the other block is in progress (there is none after the end of file)
+    bool failed;   // a read failed, all later reads fail as well
+
+    /* compressed input, which is read into in and decompressed into the blocks (then always on the thread) */
+    decompressor *decompressor;
+    char *in;
+    const char *in_pos;
+    const char *in_end;
+    bool in_eof;
+
+    /* io_uring, with room for one read (the raw kernel interface, as liburing might not be installed) */
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    void *sqes_map;
+    size_t sqes_size;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // for both a new request and a finished read
+    bool requested;
+    bool finished;
+    bool quit;
+    ssize_t result;
+};
+
+static ssize_t read_block(int fd, char *block, size_t size)
+{
+    ssize_t nr_read;
+    do {
+        nr_read = read(fd, block, size);
+    } while (nr_read < 0 && errno == EINTR);
+    return nr_read;
+}
+
+// read (and decompress) the next part of the input into block, returns as read()
+static ssize_t fill_block(read_ahead *ra, char *block)
+{
+    if (!ra->decompressor) {
+        return read_block(ra->fd, block, ra->block_size);
+    }
+    while (1) {
+        if (ra->in_pos == ra->in_end && !ra->in_eof) {
+            ssize_t nr_read = read_block(ra->fd, ra->in, ra->block_size);
+            if (nr_read < 0) {
+                return -1;
+            }
+            ra->in_pos = ra->in;
+            ra->in_end = ra->in + nr_read;
+            ra->in_eof = nr_read == 0;
+        }
+        if (ra->in_pos == ra->in_end && ra->in_eof) {
+            if (!decompressor_finished(ra->decompressor)) {
+                errno = EIO;  // cut short
+                return -1;
+            }
+            return 0;
+        }
+        ssize_t length = decompress(ra->decompressor, &ra->in_pos, ra->in_end, block, ra->block_size);
+        if (length < 0) {
+            errno = EIO;
+            return -1;
+        }
+        if (length > 0) {
+            return length;
+        }
+    }
+}
+
+// read the start of the input into block 0 (as the first block) to see whether it is compressed, returns 0 on success
+static int peek(read_ahead *ra)
+{
+    size_t length = 0;
+    ssize_t nr_read;
+    do {
+        nr_read = read_block(ra->fd, ra->blocks[0] + length, ra->block_size - length);
+        if (nr_read < 0) {
+            return 1;
+        }
+        length += (size_t)nr_read;
+    } while (nr_read > 0 && length < 4 && length < ra->block_size);
+
+    enum compression compression = compression_of(ra->blocks[0], length);
+    if (compression == COMPRESSION_NONE) {
+        ra->current = 0;
+        ra->length = length;
+        return 0;
+    }
+    ra->decompressor = decompressor_start(compression);
+    ra->in = malloc(ra->block_size);
+    if (!ra->decompressor || !ra->in) {
+        if (!ra->decompressor) {
+            fprintf(stderr, "Can not read %s compressed input, not supported by this build\n",
+                    compression_name(compression));
+        }
+        return 1;
+    }
+    memcpy(ra->in, ra->blocks[0], length);
+    ra->in_pos = ra->in;
+    ra->in_end = ra->in + length;
+    ra->in_eof = nr_read == 0;
+    ra->current = 1;  // (used up, so the first block is decompressed into block 0)
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+static int ring_start(read_ahead *ra)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ra->ring_fd = (int)syscall(SYS_io_uring_setup, 2, &params);
+    if (ra->ring_fd < 0) {
+        return 1;
+    }
+    // reads at the file position (offset -1) also work for pipes, kernel 5.6 and later
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ra->ring_fd);
+        return 1;
+    }
+
+    ra->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ra->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ra->sq_ring_size = ra->sq_ring_size > ra->cq_ring_size ? ra->sq_ring_size : ra->cq_ring_size;
+    }
+    ra->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ra->sq_ring = mmap(NULL, ra->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ra->ring_fd,
+                       IORING_OFF_SQ_RING);
+    ra->cq_ring = ra->sq_ring;
+    if (ra->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ra->cq_ring = mmap(NULL, ra->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ra->ring_fd,
+                           IORING_OFF_CQ_RING);
+    }
+    ra->sqes_map = mmap(NULL, ra->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ra->ring_fd,
+                        IORING_OFF_SQES);
+    if (ra->sq_ring == MAP_FAILED || ra->cq_ring == MAP_FAILED || ra->sqes_map == MAP_FAILED) {
+        if (ra->sqes_map != MAP_FAILED) {
+            munmap(ra->sqes_map, ra->sqes_size);
+        }
+        if (ra->cq_ring != MAP_FAILED && ra->cq_ring != ra->sq_ring) {
+            munmap(ra->cq_ring, ra->cq_ring_size);
+        }
+        if (ra->sq_ring != MAP_FAILED) {
+            munmap(ra->sq_ring, ra->sq_ring_size);
+        }
+        close(ra->ring_fd);
+        return 1;
+    }
+
+    ra->sq_tail = (unsigned int *)(void *)((char *)ra->sq_ring + params.sq_off.tail);
+    ra->sq_mask = (unsigned int *)(void *)((char *)ra->sq_ring + params.sq_off.ring_mask);
+    ra->sq_array = (unsigned int *)(void *)((char *)ra->sq_ring + params.sq_off.array);
+    ra->cq_head = (unsigned int *)(void *)((char *)ra->cq_ring + params.cq_off.head);
+    ra->cq_tail = (unsigned int *)(void *)((char *)ra->cq_ring + params.cq_off.tail);
+    ra->cq_mask = (unsigned int *)(void *)((char *)ra->cq_ring + params.cq_off.ring_mask);
+    ra->cqes = (struct io_uring_cqe *)(void *)((char *)ra->cq_ring + params.cq_off.cqes);
+    return 0;
+}
+
+static void ring_stop(read_ahead *ra)
+{
+    munmap(ra->sqes_map, ra->sqes_size);
+    if (ra->cq_ring != ra->sq_ring) {
+        munmap(ra->cq_ring, ra->cq_ring_size);
+    }
+    munmap(ra->sq_ring, ra->sq_ring_size);
+    close(ra->ring_fd);
+}
+
+// returns 0 on success
+static int ring_submit(read_ahead *ra, char *block)
+{
+    unsigned int tail = *ra->sq_tail, index = tail & *ra->sq_mask;  // (we are the only one adding requests)
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)ra->sqes_map + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ra->fd;
+    sqe->addr = (uint64_t)(uintptr_t)block;
+    sqe->len = (uint32_t)ra->block_size;
+    sqe->off = (uint64_t)-1;  // at the file position
+    ra->sq_array[index] = index;
+    __atomic_store_n(ra->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    long rv;
+    do {
+        rv = syscall(SYS_io_uring_enter, ra->ring_fd, 1, 0, 0, NULL, 0);
+    } while (rv < 0 && errno == EINTR);
+    return rv == 1 ? 0 : 1;
+}
+
+// result of the read in progress, as read() but errors as -errno
+static ssize_t ring_wait(read_ahead *ra)
+{
+    while (1) {
+        unsigned int head = *ra->cq_head;  // (we are the only one taking results)
+        if (head != __atomic_load_n(ra->cq_tail, __ATOMIC_ACQUIRE)) {
+            ssize_t result = ra->cqes[head & *ra->cq_mask].res;
+            __atomic_store_n(ra->cq_head, head + 1, __ATOMIC_RELEASE);
+            return result;
+        }
+        if (syscall(SYS_io_uring_enter, ra->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+#endif
+
+static void *read_thread(void *arg)
+{
+    read_ahead *ra = arg;
+    pthread_mutex_lock(&ra->lock);
+    while (1) {
+        while (!ra->requested && !ra->quit) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+        }
+        if (ra->quit) {
+            break;
+        }
+        ra->requested = false;
+        char *block = ra->blocks[ra->current ^ 1];
+        pthread_mutex_unlock(&ra->lock);
+        ssize_t nr_read = fill_block(ra, block);
+        pthread_mutex_lock(&ra->lock);
+        ra->result = nr_read;
+        ra->finished = true;
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+static int thread_start(read_ahead *ra)
+{
+    if (pthread_mutex_init(&ra->lock, NULL) != 0) {
+        return 1;
+    }
+    if (pthread_cond_init(&ra->cond, NULL) != 0) {
+        pthread_mutex_destroy(&ra->lock);
+        return 1;
+    }
+    if (pthread_create(&ra->thread, NULL, read_thread, ra) != 0) {
+        pthread_cond_destroy(&ra->cond);
+        pthread_mutex_destroy(&ra->lock);
+        return 1;
+    }
+    return 0;
+}
+
+static void thread_stop(read_ahead *ra)
+{
+    pthread_mutex_lock(&ra->lock);
+    ra->quit = true;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->lock);
+}
+
+// start reading into the other block
+static void submit(read_ahead *ra)
+{
+    ra->reading = true;
+    switch (ra->kind) {
+#ifdef HAVE_IO_URING
+        case READ_AHEAD_IO_URING:
+            if (ring_submit(ra, ra->blocks[ra->current ^ 1]) != 0) {
+                ra->failed = true;
+            }
+            break;
+#endif
+        case READ_AHEAD_THREAD:
+            pthread_mutex_lock(&ra->lock);
+            ra->requested = true;
+            pthread_cond_broadcast(&ra->cond);
+            pthread_mutex_unlock(&ra->lock);
+            break;
+        default:
+            break;  // read when waited for
+    }
+}
+
+// wait for the read into the other block, returns as read()
+static ssize_t wait_for_read(read_ahead *ra)
+{
+    ssize_t nr_read = -1;
+    ra->reading = false;
+    if (ra->failed) {
+        return -1;
+    }
+    switch (ra->kind) {
+#ifdef HAVE_IO_URING
+        case READ_AHEAD_IO_URING:
+            while ((nr_read = ring_wait(ra)) == -EINTR || nr_read == -EAGAIN) {
+                if (ring_submit(ra, ra->blocks[ra->current ^ 1]) != 0) {
+                    return -1;
+                }
+            }
+            if (nr_read < 0) {
+                errno = (int)-nr_read;
+                nr_read = -1;
+            }
+            break;
+#endif
+        case READ_AHEAD_THREAD:
+            pthread_mutex_lock(&ra->lock);
+            while (!ra->finished) {
+                pthread_cond_wait(&ra->cond, &ra->lock);
+            }
+            ra->finished = false;
+            nr_read = ra->result;
+            pthread_mutex_unlock(&ra->lock);
+            break;
+        default:
+            nr_read = fill_block(ra, ra->blocks[ra->current ^ 1]);
+            break;
+    }
+    return nr_read;
+}
+
+read_ahead *read_ahead_start(int fd, size_t block_size)
+{
+    read_ahead *ra = calloc(1, sizeof(read_ahead));
+    char *blocks = malloc(2 * block_size);
+    if (!ra || !blocks || block_size == 0) {
+        free(ra);
+        free(blocks);
+        return NULL;
+    }
+    ra->fd = fd;
+    ra->block_size = block_size;
+    ra->blocks[0] = blocks;
+    ra->blocks[1] = blocks + block_size;
+    ra->kind = READ_AHEAD_NONE;
+    if (peek(ra) != 0) {
+        ra->failed = true;
+        return ra;
+    }
+    if (!ra->decompressor && ra->length == 0) {
+        return ra;  // empty
+    }
+#ifdef HAVE_IO_URING
+    if (!ra->decompressor && ring_start(ra) == 0) {
+        ra->kind = READ_AHEAD_IO_URING;  // (decompression would be done by the caller, so then the thread is used)
+    }
+#endif
+    if (ra->kind == READ_AHEAD_NONE && thread_start(ra) == 0) {
+        ra->kind = READ_AHEAD_THREAD;
+    }
+    submit(ra);
+    return ra;
+}
+
+void read_ahead_stop(read_ahead *ra)
+{
+    if (!ra) {
+        return;
+    }
+    if (ra->reading && ra->kind != READ_AHEAD_NONE) {
+        wait_for_read(ra);  // (the kernel or thread may still write to the block)
+    }
+    switch (ra->kind) {
+#ifdef HAVE_IO_URING
+        case READ_AHEAD_IO_URING:
+            ring_stop(ra);
+            break;
+#endif
+        case READ_AHEAD_THREAD:
+            thread_stop(ra);
+            break;
+        default:
+            break;
+    }
+    decompressor_stop(ra->decompressor);
+    free(ra->in);
+    free(ra->blocks[0]);  // (both blocks are one allocation)
+    free(ra);
+}
+
+ssize_t read_ahead_read(read_ahead *ra, void *buffer, size_t size)
+{
+    if (ra->pos == ra->length) {
+        if (!ra->reading) {
+            return ra->failed ? -1 : 0;  // end of file
+        }
+        ssize_t nr_read = wait_for_read(ra);
+        if (nr_read < 0) {
+            ra->failed = true;
+            return -1;
+        }
+        ra->current ^= 1;
+        ra->pos = 0;
+        ra->length = (size_t)nr_read;
+        if (nr_read == 0) {
+            return 0;
+        }
+        submit(ra);  // the next block is read while this one is used
+    }
+    size_t length = ra->length - ra->pos < size ? ra->length - ra->pos : size;
+    memcpy(buffer, ra->blocks[ra->current] + ra->pos, length);
+    ra->pos += length;
+    return (ssize_t)length;
+}
+
+const char *read_ahead_method(const read_ahead *ra)
+{
+    switch (ra->kind) {
+        case READ_AHEAD_IO_URING:
+            return "io_uring";
+        case READ_AHEAD_THREAD:
+            return "thread";
+        default:
+            return "none";
+    }
+}
@@ -0,0 +1,24 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Read a file (or pipe) ahead of its use, in blocks: while the caller works on one block the next is read
+ *  (double buffering). Reads are done with io_uring if the kernel supports it (not if built with
+ *  READ_AHEAD_NO_IO_URING), otherwise on a thread of their own, or if neither works when the data is asked for.
+ * Input compressed with gzip or zstd is decompressed (on the thread) if the build supports it, see decompress.h.
+ */
+typedef struct read_ahead read_ahead;
+
+// start reading fd in blocks of block_size (the first block is read now), returns NULL if out of memory
+read_ahead *read_ahead_start(int fd, size_t block_size);
+// stop reading (waits for the read in progress), fd is not closed
+void read_ahead_stop(read_ahead *);
+// as read(): up to size bytes to buffer, returns nr of bytes (0 at end of file) or -1 on error
+ssize_t read_ahead_read(read_ahead *, void *buffer, size_t size);
+// how reads are done: "io_uring", "thread" or "none"
+const char *read_ahead_method(const read_ahead *);
+
+#endif
@@ -1,330 +1,1316 @@
 // Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
 #include "read_input.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "decompress.h"
+#include "parse_int.h"
+#include "read_ahead.h"
 
 /* Some functions to read input from text file.
  *  Tried some different variations, where
  *      read_ints_per_line
  *  is the most recent and useful to read ints from file.
+ *  They are now all read_table with a schema of their format, which parses any kind of record into columns.
+ *
+ * The whole file is mapped to memory (or read with read() if it can't be mapped, e.g. a pipe, or is compressed),
+ *  lines are counted with memchr, and then records are parsed in one pass over the buffer.
+ *  Ints are parsed as fscanf's %d by parse_int, but an int which does not fit is an error.
  */
-// TODO seg faults if file does not exist?
+
+typedef struct {
+    const char *data;
+    size_t size;
+    void *map;  // mmap'd file, or NULL if data was read into a buffer (which we free)
+} input_buffer;
+
+// read all of file into buffer (decompressed), when it can't be mapped. Returns 0 on success
+static int read_file(int fd, input_buffer *buf)
+{
+    size_t size = 0, buffer_size = 1 << 16;
+    char *buffer = malloc(buffer_size);
+    read_ahead *ra = read_ahead_start(fd, buffer_size);
+    ssize_t nr_read;
+
+    if (!ra) {
+        free(buffer);
+        return 1;
+    }
+
+    while (buffer) {
+        if (size == buffer_size) {
+            char *bigger = realloc(buffer, buffer_size * 2);
+            if (!bigger) {
+                break;
+            }
+            buffer = bigger;
+            buffer_size *= 2;
+        }
+        nr_read = read_ahead_read(ra, buffer + size, buffer_size - size);
+        if (nr_read == 0) {
+            buf->data = buffer;
+            buf->size = size;
+            buf->map = NULL;
+            read_ahead_stop(ra);
+            return 0;
+        }
+        if (nr_read < 0) {
+            break;
+        }
+        size += (size_t)nr_read;
+    }
+    free(buffer);
+    read_ahead_stop(ra);
+    return 1;
+}
+
+// map (or read) all of file, returns 0 on success
+static int load_file(const char *file_name, input_buffer *buf)
+{
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    int rv = 1;
+
+    memset(buf, 0, sizeof(input_buffer));
+    if (fd < 0) {
+        return 1;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED && compression_of(map, (size_t)st.st_size) != COMPRESSION_NONE) {
+            munmap(map, (size_t)st.st_size);  // read (and decompressed) below instead
+            map = MAP_FAILED;
+        }
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            buf->data = map;
+            buf->size = (size_t)st.st_size;
+            buf->map = map;
+            rv = 0;
+        }
+    }
+    if (rv != 0) {
+        rv = read_file(fd, buf);  // not a regular file (or a file whose size is unknown, as in /proc), or compressed
+    }
+    close(fd);
+    return rv;
+}
+
+static void unload_file(input_buffer *buf)
+{
+    if (buf->map) {
+        munmap(buf->map, buf->size);
+    } else {
+        free((void *)buf->data);
+    }
+    memset(buf, 0, sizeof(input_buffer));
+}
+
+// number of lines from start to end, a last line without newline counts as well.
+//  The length of the longest line (without newline) goes to longest, unless it is NULL
+static size_t lines_between(const char *start, const char *end, size_t *longest)
+{
+    size_t lines = 0, max_length = 0;
+    const char *line = start;
+    for (const char *p = start; (p = memchr(p, '\n', (size_t)(end - p))); line = ++p) {
+        max_length = (size_t)(p - line) > max_length ? (size_t)(p - line) : max_length;
+        lines++;
+    }
+    if (end > start && end[-1] != '\n') {
+        max_length = (size_t)(end - line) > max_length ? (size_t)(end - line) : max_length;
+        lines++;
+    }
+    if (longest) {
+        *longest = max_length;
+    }
+    return lines;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+// find string at p (after optional whitespace) as fscanf's %s, returns position after it or NULL if there is none
+static const char *find_str(const char *p, const char *end, const char **str, size_t *length)
+{
+    p = skip_space(p, end);
+    *str = p;
+    while (p < end && !is_space(*p)) {
+        p++;
+    }
+    *length = (size_t)(p - *str);
+    return *length ? p : NULL;
+}
 
 /*
- * Read ints split by line
- *  ( Used e.g. in 4/ )
+ * String table: the index (str_entry) and all chars in one allocation, index first.
+ *  It is filled in one pass, so it is first given room for the worst case and then shrunk to what is used.
  */
-int read_ints_per_line(const char *file_name, unsigned int *entries, line_entry **out_ints)
+
+// room for nr_of_strs strings of chars_size chars in total (not including '\0'), returns 0 on success
+static int str_table_reserve(str_table *strs, unsigned int nr_of_strs, size_t chars_size)
 {
-    FILE *file = fopen(file_name, "r");
-    unsigned int lines = 0, hits;
-    line_entry *ints = NULL;
+    size_t index_size = nr_of_strs * sizeof(str_entry);
+    char *block = malloc(index_size + chars_size + nr_of_strs);
+    if (!block) {
+        return 1;
+    }
+    strs->entries = (str_entry *)(void *)block;
+    strs->chars = block + index_size;
+    strs->nr_of_strs = 0;
+    strs->chars_length = 0;
+    return 0;
+}
 
-    size_t line_width = 128;  // arbitrary size, how long line (nr of ints) to allocate
+// room for nr_of_strs strings (more than reserved), where chars_capacity is the room for chars (with '\0's)
+//  after the index, which stays the same. Returns 0 on success
+static int str_table_grow(str_table *strs, unsigned int nr_of_strs, size_t chars_capacity)
+{
+    size_t index_size = nr_of_strs * sizeof(str_entry);
+    size_t chars_offset = (size_t)(strs->chars - (char *)strs->entries);
+    char *block = realloc(strs->entries, index_size + chars_capacity);
+    if (!block) {
+        return 1;
+    }
+    memmove(block + index_size, block + chars_offset, strs->chars_length);
+    strs->entries = (str_entry *)(void *)block;
+    strs->chars = block + index_size;
+    return 0;
+}
 
-    if (!file) {
-        goto error;
+static void str_table_add(str_table *strs, const char *str, size_t length)
+{
+    str_entry *entry = &strs->entries[strs->nr_of_strs++];
+    entry->offset = strs->chars_length;
+    entry->length = length;
+    memcpy(strs->chars + strs->chars_length, str, length);
+    strs->chars[strs->chars_length + length] = '\0';
+    strs->chars_length += length + 1;
+}
+
+// size of index and chars
+static size_t str_table_size(const str_table *strs)
+{
+    return strs->nr_of_strs * sizeof(str_entry) + strs->chars_length;
+}
+
+// size of the chars of the first nr_of_strs strings
+static size_t chars_used(const str_table *strs, size_t nr_of_strs)
+{
+    if (nr_of_strs == 0) {
+        return 0;
     }
+    const str_entry *last = &strs->entries[nr_of_strs - 1];
+    return last->offset + last->length + 1;
+}
 
-    // count lines
-    while (1) {
-        if (fgetc(file) == '\n') {
-            lines++;
+// move chars to right after the used part of the index, and give back the rest
+static void str_table_shrink(str_table *strs)
+{
+    char *block = (char *)strs->entries;
+    size_t index_size = strs->nr_of_strs * sizeof(str_entry);
+    memmove(block + index_size, strs->chars, strs->chars_length);
+    char *smaller = realloc(block, index_size + strs->chars_length + 1);
+    if (smaller) {
+        block = smaller;  // (else the bigger block is still fine)
+    }
+    strs->entries = (str_entry *)(void *)block;
+    strs->chars = block + index_size;
+}
+
+void free_str_table(str_table *strs)
+{
+    if (!strs) {
+        return;
+    }
+    if (strs->map) {
+        munmap(strs->map, strs->map_size);
+    } else {
+        free(strs->entries);  // (chars are in the same allocation)
+    }
+    memset(strs, 0, sizeof(str_table));
+}
+
+void free_int_lines(int_lines *lines)
+{
+    if (!lines) {
+        return;
+    }
+    if (lines->map) {
+        munmap(lines->map, lines->map_size);
+    } else {
+        free(lines->offsets);
+        free(lines->values);
+    }
+    memset(lines, 0, sizeof(int_lines));
+}
+
+/*
+ * Schema, see read_table: parsed into the columns of a table (without values),
+ *  the names and symbols are in a copy of the schema where '\0' is put after each.
+ */
+static int parse_schema(const char *schema, table *t)
+{
+    memset(t, 0, sizeof(table));
+    t->schema = malloc(strlen(schema) + 1);
+    if (!t->schema) {
+        return 1;
+    }
+    strcpy(t->schema, schema);
+
+    for (char *p = t->schema; *p;) {
+        while (is_space(*p)) {
+            p++;
         }
-        if (feof(file) != 0) {
-            break;  // done
+        if (!*p) {
+            break;
         }
-        if (ferror(file) != 0) {
-            goto error;
+        if (t->nr_of_columns == TABLE_MAX_COLUMNS ||
+            (t->nr_of_columns > 0 && t->columns[t->nr_of_columns - 1].type == COLUMN_INTS)) {
+            goto invalid;
+        }
+        column *col = &t->columns[t->nr_of_columns++];
+        char *type = p;
+        while (*p && !is_space(*p)) {
+            p++;
+        }
+        if (*p) {
+            *p++ = '\0';
+        }
+        col->name = "";
+        char *colon = strchr(type, ':');
+        if (colon) {
+            *colon = '\0';
+            col->name = type;
+            type = colon + 1;
+        }
+
+        size_t length = strlen(type);
+        if (strcmp(type, "int") == 0) {
+            col->type = COLUMN_INT;
+        } else if (strcmp(type, "str") == 0) {
+            col->type = COLUMN_STR;
+        } else if (strcmp(type, "bitstring") == 0) {
+            col->type = COLUMN_BITS;
+        } else if (strcmp(type, "ints") == 0) {
+            col->type = COLUMN_INTS;
+        } else if (strncmp(type, "enum(", 5) == 0 && type[length - 1] == ')') {
+            col->type = COLUMN_ENUM;
+            type[length - 1] = '\0';
+            for (char *symbol = type + 5; symbol;) {
+                char *comma = strchr(symbol, ',');
+                if (comma) {
+                    *comma = '\0';
+                }
+                if (!*symbol || col->nr_of_symbols == COLUMN_MAX_SYMBOLS) {
+                    goto invalid;
+                }
+                col->symbols[col->nr_of_symbols++] = symbol;
+                symbol = comma ? comma + 1 : NULL;
+            }
+        } else {
+            goto invalid;
         }
     }
-    if (lines == 0) {
-        goto error;
+    if (t->nr_of_columns == 0) {
+        goto invalid;
     }
-    ints = calloc(lines, sizeof(line_entry));
+    return 0;
+invalid:
+    fprintf(stderr, "Invalid schema: %s\n", schema);
+    exit(1);
+}
 
-    for (unsigned int i = 0; i < lines; i++) {
-        ints[i].elems = calloc(line_width, sizeof(int));
+/*
+ * Columns: the arrays of a column depend on its type. The size of the values of a column is
+ *  nr of records plus (for str) the nr of chars, or (for ints) the nr of ints in all records.
+ */
+
+// room for nr_of_records values with nr_of_parts chars (str) or ints (ints) in total, returns 0 on success
+static int column_reserve(column *col, size_t nr_of_records, size_t nr_of_parts)
+{
+    size_t size = nr_of_records ? nr_of_records : 1;
+    switch (col->type) {
+        case COLUMN_INT:
+            return (col->ints = malloc(size * sizeof(int))) ? 0 : 1;
+        case COLUMN_STR:
+            return str_table_reserve(&col->strs, (unsigned int)nr_of_records, nr_of_parts);
+        case COLUMN_ENUM:
+            return (col->codes = malloc(size)) ? 0 : 1;
+        case COLUMN_BITS:
+            return (col->bits = malloc(size * sizeof(uint64_t))) ? 0 : 1;
+        case COLUMN_INTS:
+            col->lines.offsets = malloc((nr_of_records + 1) * sizeof(size_t));
+            col->lines.values = malloc((nr_of_parts ? nr_of_parts : 1) * sizeof(int));
+            if (!col->lines.offsets || !col->lines.values) {
+                return 1;
+            }
+            col->lines.offsets[0] = 0;
+            return 0;
     }
+    return 1;
+}
 
-    // find ints
-    rewind(file);
-    unsigned int line = 0;
-    size_t index = 0;
-    while (line < lines) {
-        // continue on same line
-        if (index < line_width) {
-            ints[line].nr_elems++;
-            if (fscanf(file, "%d", &ints[line].elems[index]) != 1) {
-                hits = line;  // done, no more integers
-                goto ok;
+// room for nr_of_records values, more than reserved (chars_capacity as for str_table_grow), returns 0 on success
+static int column_grow(column *col, size_t nr_of_records, size_t chars_capacity)
+{
+    void *bigger = NULL;
+    switch (col->type) {
+        case COLUMN_INT:
+            if ((bigger = realloc(col->ints, nr_of_records * sizeof(int)))) {
+                col->ints = bigger;
             }
-            if (feof(file) != 0) {
-                hits = line;
-                goto ok;
+            break;
+        case COLUMN_STR:
+            return str_table_grow(&col->strs, (unsigned int)nr_of_records, chars_capacity);
+        case COLUMN_ENUM:
+            if ((bigger = realloc(col->codes, nr_of_records))) {
+                col->codes = bigger;
             }
-            if (ferror(file) != 0) {
-                goto error;
+            break;
+        case COLUMN_BITS:
+            if ((bigger = realloc(col->bits, nr_of_records * sizeof(uint64_t)))) {
+                col->bits = bigger;
             }
-            index++;
-        } else {
-            goto error;
-        }
-        // next line
-        if (fgetc(file) == '\n') {
-            index = 0;
-            line++;
-        }
-        if (feof(file) != 0) {
-            hits = line;
-            goto ok;
-        }
-        if (ferror(file) != 0) {
-            goto error;
-        }
+            break;
+        case COLUMN_INTS:
+            if ((bigger = realloc(col->lines.offsets, (nr_of_records + 1) * sizeof(size_t)))) {
+                col->lines.offsets = bigger;
+            }
+            break;
     }
-    hits = lines;
-ok:
-    for (; lines > hits; lines--) {
-        // if less hits found than memory allocated, free the difference (i.e. unused memory)
-        free(ints[lines - 1].elems);
+    return bigger ? 0 : 1;
+}
+
+// nr of chars (str) or ints (ints) of the first nr_of_records values
+static size_t column_parts(const column *col, size_t nr_of_records)
+{
+    switch (col->type) {
+        case COLUMN_STR:
+            return chars_used(&col->strs, nr_of_records);
+        case COLUMN_INTS:
+            return col->lines.offsets[nr_of_records];
+        default:
+            return 0;
     }
+}
 
-    *entries = hits;
-    // caller frees...
-    *out_ints = ints;
-    fclose(file);
-    return 0;
-error:
-    *entries = 0;
-    *out_ints = NULL;
-    fclose(file);
-    if (ints) {
-        for (unsigned int i = 0; i < lines; i++) {
-            free(ints[i].elems);
-        }
-        free(ints);
+// the column has nr_of_records values (with nr_of_parts), give back the memory of the rest
+static void column_shrink(column *col, size_t nr_of_records, size_t nr_of_parts)
+{
+    // (if an array could not shrink, the bigger one is fine)
+    size_t size = nr_of_records ? nr_of_records : 1;
+    void *smaller;
+    switch (col->type) {
+        case COLUMN_INT:
+            smaller = realloc(col->ints, size * sizeof(int));
+            col->ints = smaller ? smaller : col->ints;
+            break;
+        case COLUMN_STR:
+            col->strs.nr_of_strs = (unsigned int)nr_of_records;
+            col->strs.chars_length = nr_of_parts;
+            str_table_shrink(&col->strs);
+            break;
+        case COLUMN_ENUM:
+            smaller = realloc(col->codes, size);
+            col->codes = smaller ? smaller : col->codes;
+            break;
+        case COLUMN_BITS:
+            smaller = realloc(col->bits, size * sizeof(uint64_t));
+            col->bits = smaller ? smaller : col->bits;
+            break;
+        case COLUMN_INTS:
+            col->lines.nr_of_lines = (unsigned int)nr_of_records;
+            smaller = realloc(col->lines.offsets, (nr_of_records + 1) * sizeof(size_t));
+            col->lines.offsets = smaller ? smaller : col->lines.offsets;
+            smaller = realloc(col->lines.values, (nr_of_parts ? nr_of_parts : 1) * sizeof(int));
+            col->lines.values = smaller ? smaller : col->lines.values;
+            break;
     }
-    return 1;
+}
+
+// forget the arrays of column (without freeing them)
+static void column_clear(column *col)
+{
+    col->ints = NULL;
+    memset(&col->strs, 0, sizeof(str_table));
+    col->codes = NULL;
+    col->bits = NULL;
+    memset(&col->lines, 0, sizeof(int_lines));
+}
+
+// give the arrays of from to to
+static void column_move(column *to, column *from)
+{
+    to->ints = from->ints;
+    to->strs = from->strs;
+    to->codes = from->codes;
+    to->bits = from->bits;
+    to->lines = from->lines;
+    column_clear(from);
+}
+
+static void column_free(column *col)
+{
+    free(col->ints);
+    free_str_table(&col->strs);
+    free(col->codes);
+    free(col->bits);
+    free_int_lines(&col->lines);
 }
 
 /*
- * Find all integers in text file
- *  ( Used e.g. in 1/ )
- *
- * Finds (up to) nr_of_lines integers (allocates memory for one integer per line).
- * One line may have any number of integers,
- * but if too many integers are found the last integers in file will be ignored.
- *
- * Caller frees int **output
+ * Records of a file are parsed in parts (chunks) on different threads, see read_input_set_threads.
+ *  Each chunk starts at the beginning of a line and is parsed to columns of its own,
+ *  then the values of all chunks are copied (again in parallel) to where they go in the table.
  */
-int read_ints(const char *file_name, unsigned int *entries, int **output)
+#define MIN_CHUNK_SIZE (1 << 20)  // a smaller part of a file is not worth a thread of its own
+#define MAX_CHUNK_RECORDS (UINT_MAX - 1)  // (those after the nr of lines of the file are not used)
+
+typedef struct {
+    const char *start;
+    const char *end;
+    table *t;  // schema, and where values go
+    size_t nr_of_lines;
+
+    /* records found */
+    column columns[TABLE_MAX_COLUMNS];
+    size_t capacity;        // nr of records the columns have room for
+    size_t chars_capacity;  // of str columns
+    size_t values_capacity[TABLE_MAX_COLUMNS];  // of ints columns
+    size_t longest_line;
+    unsigned int nr_of_records;
+    bool stopped;      // found something which is not a record, the records of later chunks are not used
+    bool invalid;      // stopped at an invalid value
+    bool failed;       // out of memory
+    const char *rest;  // where it stopped, if it may be a record which goes on in the next chunk
+
+    /* where records go in the table */
+    unsigned int nr_used;  // only the first records may be used (as the table has room for a limited nr of records)
+    unsigned int record_offset;
+    size_t part_offsets[TABLE_MAX_COLUMNS];
+} chunk;
+
+// a field of a record, before it is added to its column
+typedef struct {
+    int value;  // int, or index of enum
+    const char *str;
+    size_t length;  // of str, or nr of ints
+    uint64_t bits;
+} field;
+
+static unsigned int nr_of_threads = 1;
+
+void read_input_set_threads(unsigned int threads)
 {
-    FILE *file = fopen(file_name, "r");
-    unsigned int hits = 0;
-    int *nums;
+    if (threads == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    // (a chunk per thread is on the stack while parsing)
+    nr_of_threads = threads < READ_INPUT_MAX_THREADS ? threads : READ_INPUT_MAX_THREADS;
+}
 
-    if (!file) {
-        nums = NULL;
-        goto error;
+static enum parse_int_result parse_bits(column *col, const char **pos, const char *end, uint64_t *bits)
+{
+    const char *p = skip_space(*pos, end);
+    uint64_t value;
+    size_t width = binary_run(p, end, &value);
+    p += width;
+    if (width == 0 || (p < end && !is_space(*p))) {
+        return PARSE_INT_NONE;
     }
+    if (width > COLUMN_MAX_BITS || (col->width && width != col->width)) {
+        return PARSE_INT_OVERFLOW;
+    }
+    col->width = (unsigned int)width;
+    *bits = value;
+    *pos = p;
+    return PARSE_INT_OK;
+}
 
-    while (1) {
-        if (fgetc(file) == '\n') {
-            hits++;
+// ints of a line to values (at least one), stop is set if the line ends with something which is not an int
+static enum parse_int_result parse_line_ints(const char **pos, const char *end, int *values, size_t *nr_of_values,
+                                             bool *stop)
+{
+    const char *p = *pos;
+    size_t nr = 0;
+    enum parse_int_result result;
+
+    while ((result = parse_int(&p, end, &values[nr])) == PARSE_INT_OK) {
+        nr++;
+
+        // separator, then the next int is on the same line unless there is a newline before it
+        bool newline = p < end && *p == '\n';
+        if (p < end) {
+            p++;
         }
-        if (feof(file) != 0) {
-            break;  // done
+        while (!newline && p < end && is_space(*p)) {
+            newline = *p++ == '\n';
         }
-        if (ferror(file) != 0) {
-            goto error;
+        if (newline || p == end) {
+            break;
         }
     }
+    if (nr == 0 || result == PARSE_INT_OVERFLOW) {
+        return result;
+    }
+    *stop = result == PARSE_INT_NONE;
+    *nr_of_values = nr;
+    *pos = p;
+    return PARSE_INT_OK;
+}
 
-    nums = malloc(sizeof(unsigned int) * hits);
-    if (!nums || hits == 0) {
-        goto error;
+// field of record_nr in column, returns PARSE_INT_NONE if there is none and PARSE_INT_OVERFLOW if it is invalid
+static enum parse_int_result parse_field(column *col, unsigned int record_nr, const char **pos, const char *end,
+                                         field *f, bool *stop)
+{
+    const char *p;
+    switch (col->type) {
+        case COLUMN_INT:
+            return parse_int(pos, end, &f->value);
+        case COLUMN_STR:
+        case COLUMN_ENUM:
+            if (!(p = find_str(*pos, end, &f->str, &f->length))) {
+                return PARSE_INT_NONE;
+            }
+            if (col->type == COLUMN_ENUM) {
+                for (f->value = 0; (unsigned int)f->value < col->nr_of_symbols; f->value++) {
+                    const char *symbol = col->symbols[f->value];
+                    if (strncmp(symbol, f->str, f->length) == 0 && symbol[f->length] == '\0') {
+                        break;
+                    }
+                }
+                if ((unsigned int)f->value == col->nr_of_symbols) {
+                    return PARSE_INT_NONE;
+                }
+            }
+            *pos = p;
+            return PARSE_INT_OK;
+        case COLUMN_BITS:
+            return parse_bits(col, pos, end, &f->bits);
+        case COLUMN_INTS:
+            return parse_line_ints(pos, end, col->lines.values + col->lines.offsets[record_nr], &f->length, stop);
     }
+    return PARSE_INT_NONE;
+}
 
-    rewind(file);
-    for (unsigned int i = 0; i < hits; i++) {
-        if (fscanf(file, "%d", &nums[i]) != 1) {
-            hits = i;  // found fewer ints than nr of lines, but OK
-            goto ok;
+// room for the ints of a line in ints column i of chunk c (as record record_nr), returns 0 on success
+static int reserve_line_ints(chunk *c, unsigned int i, unsigned int record_nr)
+{
+    column *col = &c->columns[i];
+    // (a line has at most every other char an int, as each int but the last is followed by a separator)
+    size_t needed = col->lines.offsets[record_nr] + (c->longest_line + 1) / 2;
+    if (needed <= c->values_capacity[i]) {
+        return 0;
+    }
+    size_t capacity = c->values_capacity[i] * 2 > needed ? c->values_capacity[i] * 2 : needed;
+    int *values = realloc(col->lines.values, capacity * sizeof(int));
+    if (!values) {
+        return 1;
+    }
+    col->lines.values = values;
+    c->values_capacity[i] = capacity;
+    return 0;
+}
+
+static void add_record(chunk *c, const field *fields)
+{
+    unsigned int record_nr = c->nr_of_records++;
+    for (unsigned int i = 0; i < c->t->nr_of_columns; i++) {
+        column *col = &c->columns[i];
+        switch (col->type) {
+            case COLUMN_INT:
+                col->ints[record_nr] = fields[i].value;
+                break;
+            case COLUMN_STR:
+                str_table_add(&col->strs, fields[i].str, fields[i].length);
+                break;
+            case COLUMN_ENUM:
+                col->codes[record_nr] = (uint8_t)fields[i].value;
+                break;
+            case COLUMN_BITS:
+                col->bits[record_nr] = fields[i].bits;
+                break;
+            case COLUMN_INTS:
+                col->lines.offsets[record_nr + 1] = col->lines.offsets[record_nr] + fields[i].length;
+                break;
         }
-        if (feof(file) != 0) {
-            hits = i;
-            goto ok;
+    }
+}
+
+static void *parse_chunk(void *arg)
+{
+    chunk *c = arg;
+    const char *p = c->start, *end = c->end;
+    field fields[TABLE_MAX_COLUMNS];
+    enum parse_int_result result = PARSE_INT_OK;
+    bool stop = false;
+
+    // room for a record per line, there is more room made if there are more (as there may be for e.g. "int")
+    c->nr_of_lines = lines_between(p, end, &c->longest_line);
+    c->capacity = c->nr_of_lines < MAX_CHUNK_RECORDS ? c->nr_of_lines : MAX_CHUNK_RECORDS;
+    c->chars_capacity = (size_t)(end - p) + c->capacity;
+    for (unsigned int i = 0; i < c->t->nr_of_columns; i++) {
+        // (ints: an int per line, there is more room made for longer lines when found)
+        size_t parts = c->t->columns[i].type == COLUMN_INTS ? c->capacity : (size_t)(end - p);
+        c->columns[i] = c->t->columns[i];
+        c->values_capacity[i] = parts ? parts : 1;
+        if (column_reserve(&c->columns[i], c->capacity, parts) != 0) {
+            c->failed = true;
+            return NULL;
         }
-        if (ferror(file) != 0) {
-            goto error;
+    }
+
+    while (c->nr_of_records < MAX_CHUNK_RECORDS && !stop) {
+        if (c->nr_of_records == c->capacity) {
+            size_t capacity = c->capacity ? c->capacity * 2 : 1;
+            capacity = capacity < MAX_CHUNK_RECORDS ? capacity : MAX_CHUNK_RECORDS;
+            for (unsigned int i = 0; i < c->t->nr_of_columns; i++) {
+                if (column_grow(&c->columns[i], capacity, c->chars_capacity) != 0) {
+                    c->failed = true;
+                    return NULL;
+                }
+            }
+            c->capacity = capacity;
+        }
+        const char *record = p;
+        for (unsigned int i = 0; i < c->t->nr_of_columns && result == PARSE_INT_OK; i++) {
+            if (c->columns[i].type == COLUMN_INTS && reserve_line_ints(c, i, c->nr_of_records) != 0) {
+                c->failed = true;
+                return NULL;
+            }
+            result = parse_field(&c->columns[i], c->nr_of_records, &p, end, &fields[i], &stop);
         }
+        if (result != PARSE_INT_OK) {
+            p = record;  // (not all of it is used)
+            break;
+        }
+        add_record(c, fields);
     }
-ok:
-    *entries = hits;
-    *output = nums;  // caller frees
-    fclose(file);
-    return 0;
-error:
-    *entries = 0;
-    *output = NULL;
-    fclose(file);
-    if (nums) {
-        free(nums);
+    c->invalid = result == PARSE_INT_OVERFLOW;
+    c->stopped = stop || c->invalid || skip_space(p, end) != end;
+    c->rest = result == PARSE_INT_NONE ? p : NULL;
+    return NULL;
+}
+
+static void *copy_chunk(void *arg)
+{
+    chunk *c = arg;
+    for (unsigned int i = 0; i < c->t->nr_of_columns; i++) {
+        const column *from = &c->columns[i];
+        column *to = &c->t->columns[i];
+        unsigned int offset = c->record_offset;
+        size_t part_offset = c->part_offsets[i];
+
+        switch (from->type) {
+            case COLUMN_INT:
+                memcpy(to->ints + offset, from->ints, c->nr_used * sizeof(int));
+                break;
+            case COLUMN_STR:
+                for (unsigned int k = 0; k < c->nr_used; k++) {
+                    to->strs.entries[offset + k].offset = from->strs.entries[k].offset + part_offset;
+                    to->strs.entries[offset + k].length = from->strs.entries[k].length;
+                }
+                memcpy(to->strs.chars + part_offset, from->strs.chars, column_parts(from, c->nr_used));
+                break;
+            case COLUMN_ENUM:
+                memcpy(to->codes + offset, from->codes, c->nr_used);
+                break;
+            case COLUMN_BITS:
+                memcpy(to->bits + offset, from->bits, c->nr_used * sizeof(uint64_t));
+                break;
+            case COLUMN_INTS:
+                for (unsigned int k = 0; k < c->nr_used; k++) {
+                    to->lines.offsets[offset + k] = from->lines.offsets[k] + part_offset;
+                }
+                memcpy(to->lines.values + part_offset, from->lines.values,
+                       column_parts(from, c->nr_used) * sizeof(int));
+                break;
+        }
+    }
+    return NULL;
+}
+
+// run func for all chunks, on a thread each (and the first on this thread)
+static void run_chunks(chunk *chunks, unsigned int nr_of_chunks, void *(*func)(void *))
+{
+    pthread_t threads[nr_of_chunks];
+    bool started[nr_of_chunks];
+
+    for (unsigned int i = 1; i < nr_of_chunks; i++) {
+        started[i] = pthread_create(&threads[i], NULL, func, &chunks[i]) == 0;
+    }
+    func(&chunks[0]);
+    for (unsigned int i = 1; i < nr_of_chunks; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            func(&chunks[i]);  // could not start thread, do it here instead
+        }
     }
-    return 1;
 }
 
 /*
- * Find all: string (max 10 chars) followed by an integer
- *  ( Used e.g. in 2/ )
+ * Find (up to) as many records as lines of buf into the columns of t (the lines are counted by the chunks).
+ *  Stops at the first thing which is not a record. Returns 0 on success, and 1 if there are no lines
  */
-int read_str_int(const char *file_name, unsigned int *entries, char ***out_strs, int **out_ints)
+static int parse_records(const input_buffer *buf, table *t)
 {
-    FILE *file = fopen(file_name, "r");
-    unsigned int lines = 0, hits;
-    int *nums = NULL;
-    char **strs = NULL;
+    unsigned int nr_of_chunks = 0, nr_used = 0, nr_found = 0, max_records;
+    size_t nr_of_lines = 0;
+    size_t nr_of_parts[TABLE_MAX_COLUMNS] = {0};
+    int rv = 1;
 
-    if (!file) {
-        goto error;
+    // split in chunks, each ending with a newline (or the end of file)
+    unsigned int max_chunks = nr_of_threads;
+    if (max_chunks > buf->size / MIN_CHUNK_SIZE) {
+        max_chunks = buf->size / MIN_CHUNK_SIZE > 0 ? (unsigned int)(buf->size / MIN_CHUNK_SIZE) : 1;
+    }
+    chunk chunks[max_chunks];
+    memset(chunks, 0, sizeof(chunks));
+    for (const char *p = buf->data, *end = buf->data + buf->size; p < end || nr_of_chunks == 0; nr_of_chunks++) {
+        const char *chunk_end = end;
+        if (nr_of_chunks + 1 < max_chunks && (size_t)(end - p) > buf->size / max_chunks) {
+            chunk_end = memchr(p + buf->size / max_chunks, '\n', (size_t)(end - p) - buf->size / max_chunks);
+            chunk_end = chunk_end ? chunk_end + 1 : end;
+        }
+        chunks[nr_of_chunks].start = p;
+        chunks[nr_of_chunks].end = chunk_end;
+        chunks[nr_of_chunks].t = t;
+        p = chunk_end;
+    }
+    run_chunks(chunks, nr_of_chunks, parse_chunk);
+    for (unsigned int i = 0; i < nr_of_chunks; i++) {
+        nr_of_lines += chunks[i].nr_of_lines;
+    }
+    if (nr_of_lines == 0) {
+        goto cleanup;
+    }
+    max_records = nr_of_lines < UINT_MAX ? (unsigned int)nr_of_lines : UINT_MAX;  // (found fewer is OK)
+
+    // a record may go on past the end of its chunk (when it is on more than one line), then the next chunk
+    //  did not start with a record. So it is parsed again from where the record starts, which finds nothing
+    //  if the chunk stopped for another reason (rarely more than this thread's share of work is done again)
+    for (unsigned int i = 0; i + 1 < nr_of_chunks; i++) {
+        chunk *c = &chunks[i], *next = &chunks[i + 1];
+        if (c->stopped && c->rest && !c->failed && !next->failed) {
+            const char *next_end = next->end;
+            for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+                column_free(&next->columns[k]);
+            }
+            memset(next, 0, sizeof(chunk));
+            next->start = c->rest;
+            next->end = next_end;
+            next->t = t;
+            parse_chunk(next);
+            c->stopped = false;  // (if next finds nothing, it stops there instead)
+        }
     }
 
-    while (1) {
-        if (fgetc(file) == '\n') {
-            lines++;
+    // records used of each chunk, up to the first chunk which stopped (or when there are max_records)
+    for (unsigned int i = 0; i < nr_of_chunks && nr_found < max_records; i++) {
+        chunk *c = &chunks[i];
+        if (c->failed || (c->invalid && c->nr_of_records < max_records - nr_found)) {
+            goto cleanup;  // (an invalid value, which is not after max_records)
         }
-        if (feof(file) != 0) {
-            break;  // done
+        c->nr_used = c->nr_of_records < max_records - nr_found ? c->nr_of_records : max_records - nr_found;
+        c->record_offset = nr_found;
+        for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+            column *col = &t->columns[k];
+            c->part_offsets[k] = nr_of_parts[k];
+            nr_of_parts[k] += column_parts(&c->columns[k], c->nr_used);
+            if (col->type == COLUMN_BITS && c->nr_used > 0) {
+                if (col->width && col->width != c->columns[k].width) {
+                    goto cleanup;  // (bitstrings of another width than those in an earlier chunk)
+                }
+                col->width = c->columns[k].width;
+            }
         }
-        if (ferror(file) != 0) {
-            goto error;
+        nr_found += c->nr_used;
+        nr_used = i + 1;
+        if (c->stopped) {
+            break;
         }
     }
-    if (lines == 0) {
-        goto error;
+
+    if (nr_used <= 1) {
+        // all records are in the first chunk already (or there are none)
+        for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+            column_move(&t->columns[k], &chunks[0].columns[k]);
+            column_shrink(&t->columns[k], nr_found, nr_of_parts[k]);
+        }
+    } else {
+        for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+            if (column_reserve(&t->columns[k], nr_found, nr_of_parts[k]) != 0) {
+                goto cleanup;
+            }
+        }
+        run_chunks(chunks, nr_used, copy_chunk);
+        for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+            t->columns[k].strs.nr_of_strs = t->columns[k].strs.entries ? nr_found : 0;
+            t->columns[k].strs.chars_length = t->columns[k].strs.entries ? nr_of_parts[k] : 0;
+            if (t->columns[k].lines.offsets) {
+                t->columns[k].lines.nr_of_lines = nr_found;
+                t->columns[k].lines.offsets[nr_found] = nr_of_parts[k];
+            }
+        }
+    }
+    t->nr_of_records = nr_found;
+    rv = 0;
+cleanup:
+    for (unsigned int i = 0; i < nr_of_chunks; i++) {
+        for (unsigned int k = 0; k < t->nr_of_columns; k++) {
+            column_free(&chunks[i].columns[k]);
+        }
+    }
+    return rv;
+}
+
+/*
+ * Cache, see read_input_enable_cache: the columns of a table are written to <file>.bin,
+ *  and next time they are mapped from there (without parsing) if the file has the same size, modification time
+ *  and inode, and the schema is the same. The format is a cache_header followed by the arrays of each column
+ *  (two per column, the second is empty unless it is ints), each padded to a multiple of 8 bytes
+ *  (native byte order and sizes, so only for use on the same machine).
+ */
+#define CACHE_MAGIC "AOCINPUT"
+#define CACHE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nr_of_columns;
+    uint64_t schema_hash;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_inode;
+    uint64_t nr_of_records;
+    uint64_t widths[TABLE_MAX_COLUMNS];          // of bitstrings
+    uint64_t array_sizes[TABLE_MAX_COLUMNS][2];  // in bytes
+} cache_header;
+
+static bool use_cache = false;
+
+void read_input_enable_cache(void)
+{
+    use_cache = true;
+}
+
+// stat of file_name if its table should be cached, returns true if so
+static bool cacheable(const char *file_name, struct stat *source)
+{
+    return use_cache && stat(file_name, source) == 0 && S_ISREG(source->st_mode);
+}
+
+static uint64_t hash_schema(const char *schema)
+{
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (size_t i = 0; schema[i]; i++) {
+        hash = (hash ^ (unsigned char)schema[i]) * 1099511628211ULL;
     }
+    return hash;
+}
+
+static void cache_header_init(cache_header *header, const struct stat *source, const char *schema,
+                              unsigned int nr_of_columns)
+{
+    memset(header, 0, sizeof(cache_header));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->version = CACHE_VERSION;
+    header->nr_of_columns = nr_of_columns;
+    header->schema_hash = hash_schema(schema);
+    header->source_size = (uint64_t)source->st_size;
+    header->source_mtime_sec = (int64_t)source->st_mtim.tv_sec;
+    header->source_mtime_nsec = (int64_t)source->st_mtim.tv_nsec;
+    header->source_inode = (uint64_t)source->st_ino;
+}
+
+static size_t cache_padded(uint64_t size)
+{
+    return (size_t)((size + 7) & ~(uint64_t)7);
+}
 
-    nums = malloc(sizeof(unsigned int) * lines);
-    strs = malloc(sizeof(char *) * lines);
-    for (unsigned int i = 0; i < lines; i++) {
-        strs[i] = malloc(sizeof(char) * 11);
+// name of the cache of file_name (with suffix), caller frees
+static char *cache_name(const char *file_name, const char *suffix)
+{
+    char *name = malloc(strlen(file_name) + strlen(suffix) + 1);
+    if (name) {
+        strcpy(name, file_name);
+        strcat(name, suffix);
     }
+    return name;
+}
 
-    rewind(file);
-    for (unsigned int i = 0; i < lines; i++) {
-        // string max 10 chars
-        if (fscanf(file, "%10s %d", strs[i], &nums[i]) != 2) {
-            hits = i;  // found fewer ints than nr of lines, but OK
-            goto ok;
-        }
-        if (feof(file) != 0) {
-            hits = i;
-            goto ok;
+// arrays of column (with nr_of_records values) as they are in the cache
+static void column_arrays(const column *col, unsigned int nr_of_records, const void *arrays[2], uint64_t sizes[2])
+{
+    sizes[1] = 0;
+    switch (col->type) {
+        case COLUMN_INT:
+            arrays[0] = col->ints;
+            sizes[0] = (uint64_t)nr_of_records * sizeof(int);
+            break;
+        case COLUMN_STR:
+            arrays[0] = col->strs.entries;
+            sizes[0] = str_table_size(&col->strs);
+            break;
+        case COLUMN_ENUM:
+            arrays[0] = col->codes;
+            sizes[0] = nr_of_records;
+            break;
+        case COLUMN_BITS:
+            arrays[0] = col->bits;
+            sizes[0] = (uint64_t)nr_of_records * sizeof(uint64_t);
+            break;
+        case COLUMN_INTS:
+            arrays[0] = col->lines.offsets;
+            sizes[0] = ((uint64_t)nr_of_records + 1) * sizeof(size_t);
+            arrays[1] = col->lines.values;
+            sizes[1] = col->lines.offsets[nr_of_records] * sizeof(int);
+            break;
+    }
+    if (sizes[1] == 0) {
+        arrays[1] = arrays[0];  // (nothing is written, but fwrite is not given NULL)
+    }
+}
+
+// column (with nr_of_records values) from its arrays in the cache, returns 0 if they are of the right size
+static int column_from_cache(column *col, unsigned int nr_of_records, void *const arrays[2], const uint64_t sizes[2],
+                             uint64_t width)
+{
+    size_t index_size = nr_of_records * sizeof(str_entry);
+    switch (col->type) {
+        case COLUMN_INT:
+            col->ints = arrays[0];
+            return sizes[0] == (uint64_t)nr_of_records * sizeof(int) ? 0 : 1;
+        case COLUMN_STR:
+            if (sizes[0] < index_size) {
+                return 1;
+            }
+            col->strs.nr_of_strs = nr_of_records;
+            col->strs.entries = arrays[0];
+            col->strs.chars = (char *)arrays[0] + index_size;
+            col->strs.chars_length = (size_t)sizes[0] - index_size;
+            return 0;
+        case COLUMN_ENUM:
+            col->codes = arrays[0];
+            return sizes[0] == nr_of_records ? 0 : 1;
+        case COLUMN_BITS:
+            col->bits = arrays[0];
+            col->width = (unsigned int)width;
+            return sizes[0] == (uint64_t)nr_of_records * sizeof(uint64_t) && width <= COLUMN_MAX_BITS ? 0 : 1;
+        case COLUMN_INTS:
+            if (sizes[0] != ((uint64_t)nr_of_records + 1) * sizeof(size_t)) {
+                return 1;
+            }
+            col->lines.nr_of_lines = nr_of_records;
+            col->lines.offsets = arrays[0];
+            col->lines.values = arrays[1];
+            return sizes[1] == col->lines.offsets[nr_of_records] * sizeof(int) ? 0 : 1;
+    }
+    return 1;
+}
+
+// map the cache of file_name into the columns of t if it is of the same file (source) and schema,
+//  returns 0 on success
+static int cache_load(const char *file_name, const struct stat *source, const char *schema, table *t)
+{
+    char *name = cache_name(file_name, ".bin");
+    int fd = name ? open(name, O_RDONLY) : -1;
+    struct stat st;
+    cache_header expected;
+    void *map = MAP_FAILED;
+    size_t map_size = 0;
+
+    free(name);
+    if (fd < 0) {
+        return 1;
+    }
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cache_header)) {
+        // private writable mapping, so the caller may change the columns (without changing the cache)
+        map_size = (size_t)st.st_size;
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+
+    const cache_header *header = map;
+    cache_header_init(&expected, source, schema, t->nr_of_columns);
+    if (memcmp(header, &expected, offsetof(cache_header, nr_of_records)) != 0 || header->nr_of_records >= UINT_MAX) {
+        goto stale;
+    }
+    size_t offset = sizeof(cache_header);
+    for (unsigned int i = 0; i < t->nr_of_columns; i++) {
+        void *arrays[2];
+        for (unsigned int k = 0; k < 2; k++) {
+            if (cache_padded(header->array_sizes[i][k]) > map_size - offset) {
+                goto stale;
+            }
+            arrays[k] = (char *)map + offset;
+            offset += cache_padded(header->array_sizes[i][k]);
         }
-        if (ferror(file) != 0) {
-            goto error;
+        if (column_from_cache(&t->columns[i], (unsigned int)header->nr_of_records, arrays, header->array_sizes[i],
+                              header->widths[i]) != 0) {
+            goto stale;
         }
     }
-    hits = lines;
-ok:
-    for (; lines > hits; lines--) {
-        // if less hits found than memory allocated, free unused memory
-        free(strs[lines - 1]);
+    t->nr_of_records = (unsigned int)header->nr_of_records;
+    t->map = map;
+    t->map_size = map_size;
+    return 0;
+stale:
+    for (unsigned int i = 0; i < t->nr_of_columns; i++) {
+        column_clear(&t->columns[i]);
+        t->columns[i].width = 0;
     }
+    munmap(map, map_size);
+    return 1;
+}
 
-    *entries = hits;
-    // caller frees...
-    *out_ints = nums;
-    *out_strs = strs;
-    fclose(file);
-    return 0;
-error:
-    *entries = 0;
-    *out_ints = NULL;
-    *out_strs = NULL;
-    fclose(file);
-    if (nums) {
-        free(nums);
+// write the cache of file_name, failing to do so is fine (there is just no cache)
+static void cache_save(const char *file_name, const struct stat *source, const char *schema, const table *t)
+{
+    // written to a temporary file which then replaces the cache, so a cache is never half written
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".bin.%ld", (long)getpid());
+    char *name = cache_name(file_name, ".bin"), *temp_name = cache_name(file_name, suffix);
+    FILE *file = name && temp_name ? fopen(temp_name, "wb") : NULL;
+    const char padding[8] = {0};
+    const void *arrays[TABLE_MAX_COLUMNS][2];
+    cache_header header;
+
+    cache_header_init(&header, source, schema, t->nr_of_columns);
+    header.nr_of_records = t->nr_of_records;
+    for (unsigned int i = 0; i < t->nr_of_columns; i++) {
+        header.widths[i] = t->columns[i].width;
+        column_arrays(&t->columns[i], t->nr_of_records, arrays[i], header.array_sizes[i]);
+    }
+    bool ok = file && fwrite(&header, sizeof(header), 1, file) == 1;
+    for (unsigned int i = 0; i < t->nr_of_columns * 2 && ok; i++) {
+        size_t size = (size_t)header.array_sizes[i / 2][i % 2];
+        size_t padding_size = cache_padded(size) - size;
+        ok = fwrite(arrays[i / 2][i % 2], 1, size, file) == size &&
+             fwrite(padding, 1, padding_size, file) == padding_size;
     }
-    if (strs) {
-        for (unsigned int i = 0; i < lines; i++) {
-            free(strs[i]);
+    if (file) {
+        if (fclose(file) != 0 || !ok || rename(temp_name, name) != 0) {
+            unlink(temp_name);
         }
-        free(strs);
     }
-    return 1;
+    free(name);
+    free(temp_name);
 }
 
 /*
- * Find all: strings (max 20 chars per)
- *  ( Used e.g. in 3/ )
+ * Read records as described by schema into columns, see read_table in read_input.h
+ *  Finds (up to) one record per line.
+ *
+ * Caller frees with free_table
  */
-int read_strs(const char *file_name, unsigned int *entries, char ***out_strs)
+int read_table(const char *file_name, const char *schema, table *out)
 {
-    FILE *file = fopen(file_name, "r");
-    unsigned int lines = 0, hits;
-    char **strs = NULL;
+    input_buffer buf = {0};
+    table t;
+    struct stat source;
+    bool cached = cacheable(file_name, &source);
 
-    if (!file) {
+    if (parse_schema(schema, &t) != 0) {
+        goto error;
+    }
+    if (cached && cache_load(file_name, &source, schema, &t) == 0) {
+        *out = t;
+        return 0;
+    }
+    if (load_file(file_name, &buf) != 0) {
         goto error;
     }
+    if (parse_records(&buf, &t) != 0) {
+        goto error;
+    }
+    if (cached) {
+        cache_save(file_name, &source, schema, &t);
+    }
 
-    while (1) {
-        if (fgetc(file) == '\n') {
-            lines++;
+    // caller frees...
+    *out = t;
+    unload_file(&buf);
+    return 0;
+error:
+    memset(out, 0, sizeof(table));
+    unload_file(&buf);
+    free_table(&t);
+    return 1;
+}
+
+void free_table(table *t)
+{
+    if (!t) {
+        return;
+    }
+    if (t->map) {
+        munmap(t->map, t->map_size);
+    } else {
+        for (unsigned int i = 0; i < t->nr_of_columns; i++) {
+            column_free(&t->columns[i]);
         }
-        if (feof(file) != 0) {
-            break;  // done
+    }
+    free(t->schema);
+    memset(t, 0, sizeof(table));
+}
+
+column *table_column(table *t, const char *name)
+{
+    for (unsigned int i = 0; i < t->nr_of_columns; i++) {
+        if (strcmp(t->columns[i].name, name) == 0) {
+            return &t->columns[i];
         }
-        if (ferror(file) != 0) {
-            goto error;
+    }
+    return NULL;
+}
+
+/*
+ * The readers are tables of one or two columns, whose arrays are given to the caller.
+ *  If the table is in a cache, the mapping goes to the str_table or int_lines (while ints are copied).
+ */
+
+// ints of column to caller, returns 0 on success
+static int take_ints(table *t, column *col, int **out)
+{
+    *out = col->ints;
+    if (t->map) {
+        *out = malloc(t->nr_of_records ? t->nr_of_records * sizeof(int) : 1);
+        if (!*out) {
+            return 1;
         }
+        memcpy(*out, col->ints, t->nr_of_records * sizeof(int));
     }
-    if (lines == 0) {
-        goto error;
+    col->ints = NULL;
+    return 0;
+}
+
+static void take_strs(table *t, column *col, str_table *out)
+{
+    *out = col->strs;
+    memset(&col->strs, 0, sizeof(str_table));
+    if (t->map) {
+        out->map = t->map;
+        out->map_size = t->map_size;
+        t->map = NULL;
     }
+}
 
-    strs = malloc(sizeof(char *) * lines);
-    for (unsigned int i = 0; i < lines; i++) {
-        strs[i] = malloc(sizeof(char) * 21);
+static void take_lines(table *t, column *col, int_lines *out)
+{
+    *out = col->lines;
+    memset(&col->lines, 0, sizeof(int_lines));
+    if (t->map) {
+        out->map = t->map;
+        out->map_size = t->map_size;
+        t->map = NULL;
     }
+}
 
-    rewind(file);
-    for (unsigned int i = 0; i < lines; i++) {
-        if (fscanf(file, "%s", strs[i]) != 1) {
-            hits = i;  // found fewer ints than nr of lines, but OK
-            goto ok;
-        }
-        if (feof(file) != 0) {
-            hits = i;
-            goto ok;
-        }
-        if (ferror(file) != 0) {
-            goto error;
-        }
+/*
+ * Read ints split by line
+ *  ( Used e.g. in 4/ )
+ *
+ * Ints on a line are separated by whitespace or one other character (e.g. ','), lines without ints are skipped.
+ * Stops at the first thing which is not an int.
+ *
+ * Caller frees with free_int_lines
+ */
+int read_ints_per_line(const char *file_name, int_lines *out_lines)
+{
+    table t;
+    if (read_table(file_name, "ints", &t) != 0) {
+        memset(out_lines, 0, sizeof(int_lines));
+        return 1;
     }
-    hits = lines;
-ok:
-    for (; lines > hits; lines--) {
-        // if less hits found than memory allocated, free unused memory
-        free(strs[lines - 1]);
+    take_lines(&t, &t.columns[0], out_lines);
+    free_table(&t);
+    return 0;
+}
+
+/*
+ * Find all integers in text file
+ *  ( Used e.g. in 1/ )
+ *
+ * Finds (up to) nr_of_lines integers (allocates memory for one integer per line).
+ * One line may have any number of integers,
+ * but if too many integers are found the last integers in file will be ignored.
+ *
+ * Caller frees int **output
+ */
+int read_ints(const char *file_name, unsigned int *entries, int **output)
+{
+    table t;
+    if (read_table(file_name, "int", &t) != 0 || take_ints(&t, &t.columns[0], output) != 0) {
+        free_table(&t);
+        *entries = 0;
+        *output = NULL;
+        return 1;
     }
+    *entries = t.nr_of_records;
+    free_table(&t);
+    return 0;
+}
 
-    *entries = hits;
-    // caller frees...
-    *out_strs = strs;
-    fclose(file);
+/*
+ * Find all: string followed by an integer
+ *  ( Used e.g. in 2/ )
+ *
+ * Caller frees with free_str_table and free(*out_ints)
+ */
+int read_str_int(const char *file_name, str_table *out_strs, int **out_ints)
+{
+    table t;
+    if (read_table(file_name, "str int", &t) != 0 || take_ints(&t, &t.columns[1], out_ints) != 0) {
+        free_table(&t);
+        *out_ints = NULL;
+        memset(out_strs, 0, sizeof(str_table));
+        return 1;
+    }
+    take_strs(&t, &t.columns[0], out_strs);
+    free_table(&t);
     return 0;
-error:
-    *entries = 0;
-    *out_strs = NULL;
-    fclose(file);
-    if (strs) {
-        for (unsigned int i = 0; i < lines; i++) {
-            free(strs[i]);
-        }
-        free(strs);
+}
+
+/*
+ * Find all: strings
+ *  ( Used e.g. in 3/ )
+ *
+ * Caller frees with free_str_table
+ */
+int read_strs(const char *file_name, str_table *out_strs)
+{
+    table t;
+    if (read_table(file_name, "str", &t) != 0) {
+        memset(out_strs, 0, sizeof(str_table));
+        return 1;
     }
-    return 1;
+    take_strs(&t, &t.columns[0], out_strs);
+    free_table(&t);
+    return 0;
 }
@@ -1,10 +1,108 @@
 // Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include <stddef.h>
+#include <stdint.h>
+
+// Cache results of the readers in <file>.bin next to each file read, to skip parsing next time (if file is the same).
+//  There is one cache per file, so reading the same file with another schema (or reader) replaces it.
+void read_input_enable_cache(void);
+// Number of threads used to parse a file (one per MB of file at most), default is 1.
+//  More than READ_INPUT_MAX_THREADS is the same as READ_INPUT_MAX_THREADS.
+#define READ_INPUT_MAX_THREADS 64
+void read_input_set_threads(unsigned int nr_of_threads);
+
 int read_ints(const char *, unsigned int *, int **);
-int read_str_int(const char *, unsigned int *, char ***, int **);
-int read_strs(const char *, unsigned int *, char ***);
 
+// strings in one block of memory, each string is followed by '\0'
+typedef struct {
+    size_t offset;  // in chars
+    size_t length;
+} str_entry;
+typedef struct {
+    unsigned int nr_of_strs;
+    str_entry *entries;
+    char *chars;
+    size_t chars_length;
+    void *map;  // the cache it is in (see read_input_enable_cache), or NULL if allocated
+    size_t map_size;
+} str_table;
+static inline const char *str_at(const str_table *strs, unsigned int i)
+{
+    return strs->chars + strs->entries[i].offset;
+}
+void free_str_table(str_table *);
+
+int read_str_int(const char *, str_table *, int **);
+int read_strs(const char *, str_table *);
+
+// ints of all lines in one array, the ints of line i are values[offsets[i]] up to values[offsets[i + 1]] (excluded)
 typedef struct {
-    unsigned int nr_elems;
-    int *elems;
-} line_entry;
-int read_ints_per_line(const char *, unsigned int *, line_entry **);
+    unsigned int nr_of_lines;
+    size_t *offsets;  // nr_of_lines + 1
+    int *values;
+    void *map;  // the cache it is in (see read_input_enable_cache), or NULL if allocated
+    size_t map_size;
+} int_lines;
+static inline int *line_ints(const int_lines *lines, unsigned int i)
+{
+    return lines->values + lines->offsets[i];
+}
+static inline size_t line_length(const int_lines *lines, unsigned int i)
+{
+    return lines->offsets[i + 1] - lines->offsets[i];
+}
+void free_int_lines(int_lines *);
+
+int read_ints_per_line(const char *, int_lines *);
+
+/*
+ * Tables: records of a file as described by a schema, each field of a record in an array of its own (a column).
+ *  The readers above are read_table with schema "int", "str int", "str" and "ints".
+ *
+ * A schema is the fields of a record separated by spaces, each field is [name:]type where type is one of
+ *      int             an int
+ *      str             a string, as fscanf's %s
+ *      enum(a,b,...)   one of the given strings, as its index in the list
+ *      bitstring       0s and 1s (COLUMN_MAX_BITS at most), as one word where the last digit is the lowest bit.
+ *                      All bitstrings of a column must have the same number of digits (width)
+ *      ints            all ints of the rest of the line, as read_ints_per_line (only as the last field)
+ *  e.g. "direction:enum(forward,down,up) int".
+ *
+ * Fields are separated by whitespace, a record may continue on the next line (but there is at most one per line).
+ *  Stops at the first record which does not match the schema, an invalid value (int which does not fit,
+ *  bitstring of another width) is an error. An invalid schema is a programming error (exits).
+ */
+#define TABLE_MAX_COLUMNS 8
+#define COLUMN_MAX_SYMBOLS 32
+#define COLUMN_MAX_BITS 64
+
+enum column_type { COLUMN_INT, COLUMN_STR, COLUMN_ENUM, COLUMN_BITS, COLUMN_INTS };
+
+typedef struct {
+    enum column_type type;
+    const char *name;  // as given in schema, or "" if none
+    const char *symbols[COLUMN_MAX_SYMBOLS];  // enum
+    unsigned int nr_of_symbols;
+    unsigned int width;  // bitstring, nr of digits
+
+    /* values, one per record (only the array of the column's type is used) */
+    int *ints;        // int
+    str_table strs;   // str
+    uint8_t *codes;   // enum, index in symbols
+    uint64_t *bits;   // bitstring
+    int_lines lines;  // ints, a line per record
+} column;
+
+typedef struct {
+    unsigned int nr_of_records;
+    unsigned int nr_of_columns;
+    column columns[TABLE_MAX_COLUMNS];
+    char *schema;  // copy of the schema, names and symbols point into it
+    void *map;     // the cache the columns are in (see read_input_enable_cache), or NULL if allocated
+    size_t map_size;
+} table;
+
+// Caller frees with free_table
+int read_table(const char *file_name, const char *schema, table *);
+void free_table(table *);
+// column with name, or NULL if there is none
+column *table_column(table *, const char *name);
@@ -2,9 +2,11 @@
 #include "react.h"
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "thread_pool.h"
 
 /*
  * Define no debug to enable asserts.
@@ -14,21 +16,163 @@
 //#define NDEBUG //uncomment this line to disable asserts
 #include <assert.h>
 
+/* One propagation, i.e. the changed input cells (new_value set) of one component */
+typedef struct propagation {
+    reactor *reactor;
+    cell **inputs;
+    size_t nr_of_inputs;
+    change_list *changes;  // changed cells are added here, if not NULL
+    cell *from;            // parent of the cell being visited (when going deeper), see aggregate_update
+} propagation;
+
+/* Subscription to change feed, filter is sorted (by address) */
+typedef struct subscription {
+    subscription_id id;
+    change_feed func;
+    void *data;
+    cell **filter;
+    size_t filter_length;
+    struct subscription *next;
+} subscription;
+
+/* Old value of a cell changed during speculation */
+typedef struct undo_entry {
+    cell *cell;
+    int old_value;
+    bool refreshed;     // a dead cell computed during speculation, old_value is the value it was computed to
+    unsigned int slot;  // if not 0, old_value is the value of parent slot - 1 as seen by aggregate cell
+} undo_entry;
+
+/* Values of REACTOR_CHUNK_SIZE consecutive cells (by cell index) in a fork */
+typedef struct value_chunk {
+    reactor *owner;  // chunks may be shared with the forks of the owner, but only the owner changes it
+    int value[REACTOR_CHUNK_SIZE];
+    int new_value[REACTOR_CHUNK_SIZE];
+} value_chunk;
+
+/* Memory reserved with reactor_reserve, cells and children are taken from the latest slab until it is full */
+typedef struct slab {
+    struct slab *next;
+    size_t used;
+    size_t size;
+    max_align_t memory[];
+} slab;
+
+/* Aggregate cell, over its parents (each only once) and the value each had the last time it was added */
+typedef struct aggregate_parent {
+    cell *cell;
+    int seen;
+    unsigned int multiplicity;  // times the parent was given (for sum and count)
+} aggregate_parent;
+
+typedef struct aggregate {
+    enum aggregate_kind kind;
+    aggregate_parent *parents;
+    unsigned int nr_of_parents;
+    unsigned int *slots;  // hash table of parent (cell) -> index in parents + 1, 0 is empty
+    size_t slots_size;    // power of two
+    int64_t total;        // sum or count
+    int *tree;            // min or max: segment tree, tree[1] is the root and the leaves start at tree[tree_size]
+    size_t tree_size;
+} aggregate;
+
+/* Cached result of a memoizing compute cell */
+typedef struct memo_entry {
+    int args[2];
+    int result;
+    bool valid;
+} memo_entry;
+
+/* A changed input cell and its component, see set_cell_values */
+typedef struct pending_update {
+    unsigned int root;
+    cell *input;
+} pending_update;
+
 /* functions which applies an action to a cell and all children */
 static void all_delete(cell *);
-static void all_compute(cell *);
-static void all_invoke(cell *);
+static void all_compute(propagation *, cell *);
+static void all_invoke(propagation *, cell *);
 
 /* helpers to these functions */
 enum iterate_order { FROM_FIRST_TO_LAST_CELL, FROM_LAST_TO_FIRST_CELL };
-static bool compute_value(cell *);
-static bool invoke_callbacks(cell *);
-static bool delete_cell(cell *);
-static void iterate_over_all_children(cell *, enum iterate_order, bool (*func)(cell *));
+static bool compute_value(propagation *, cell *);
+static bool invoke_callbacks(propagation *, cell *);
+static bool delete_cell(propagation *, cell *);
+static void iterate_over_all_children(propagation *, cell *, enum iterate_order, bool (*func)(propagation *, cell *));
+
+/* propagation of input changes, per component */
+static void propagate(propagation *);
+static void propagate_task(void *, size_t);
+static int compare_pending_updates(const void *, const void *);
+static unsigned int component_root(const reactor *, unsigned int);
+static unsigned int component_find(reactor *, unsigned int);
+static void component_union(reactor *, unsigned int, unsigned int);
+
+/* hash-consing */
+static cell **consed_slot(reactor *r, cell *parent1, cell *parent2, compute1, compute2);
+static void consed_insert(reactor *r, cell *c);
+static void consed_remove(reactor *r, cell *c);
+static cell *retain_consed(reactor *r, cell *parent1, cell *parent2, compute1, compute2);
+
+/* values of cells in reactor r, where r is either c->reactor or one of its forks */
+static inline int get_value(reactor *r, cell *c);
+static inline int get_new_value(reactor *r, cell *c);
+static inline void set_value(reactor *r, cell *c, int value);
+static inline void set_new_value(reactor *r, cell *c, int new_value);
+static value_chunk *writable_chunk(reactor *r, cell *c);
+
+/* call compute function of a compute cell, with memoization */
+static int call_compute(reactor *r, cell *c, int arg1, int arg2);
+static void enable_memo(cell *c, unsigned int memo_size);
+
+/* aggregate cells */
+static unsigned int aggregate_slot(const aggregate *a, const cell *parent);
+static void aggregate_add_parent(aggregate *a, cell *parent);
+static void aggregate_set(aggregate *a, unsigned int slot, int value);
+static int aggregate_value(const aggregate *a);
+static int aggregate_update(reactor *r, cell *c, cell *parent);
+static int aggregate_recompute(reactor *r, cell *c, bool save_state, bool new_values);
+static void free_aggregate(aggregate *a);
+
+/* parents of any kind of cell */
+static inline bool is_compute_cell(const cell *c);
+static inline unsigned int nr_of_parents(const cell *c);
+static inline cell *get_parent(const cell *c, unsigned int k);
+
+/* liveness */
+static void update_liveness(cell *c);
+static int refresh_value(reactor *r, cell *c);
+static int recompute(reactor *r, cell *c);
+
+/* cell construction, without checking the arguments */
+static cell *add_input_cell(reactor *r, int initial_value);
+static cell *add_compute_cell(reactor *r, cell *c1, cell *c2, compute1, compute2);
+static bool is_valid_spec(reactor *r, const cell_spec *specs, size_t spec_nr);
+static void *slab_alloc(reactor *r, size_t size);
+static cell *alloc_cell(reactor *r);
+static void free_cell(cell *c);
+static int reserve_cells(reactor *r, size_t nr_of_cells);
+static void reserve_children(reactor *r, cell *c, size_t size);
+static void free_children(cell *c);
 
 /* other internal functions */
+static void check_not_frozen(reactor *r);
+static void add_to_cells(reactor *r, cell *c);
+static void set_and_propagate(reactor *r, cell *c, int new_value);
+static void record_update(reactor *r, cell *c, int new_value);
+static void write_records(reactor *r, const reactor_log_record *records, size_t nr_of_records);
+static void add_change(change_list *list, cell *c, int old_value, int new_value);
+static void deliver_changes(reactor *r);
+static int compare_cells(const void *, const void *);
+static size_t run_length(cell **list, size_t length, size_t i);
+static void save_old_value(reactor *r, cell *c);
+static void save_old_slot(reactor *r, cell *c, unsigned int slot);
+static void append_undo_entry(reactor *r, cell *c, int old_value, unsigned int slot);
+static void run_callbacks(callback_st *cb_st, int new_value);
 static void destroy_cell_callbacks(cell *c);
-static cell *compute_cell_add_child(cell *c, cell *child);
+static void compute_cell_add_child(reactor *r, cell *c, cell *child);
+static void compute_cell_remove_child(cell *c, cell *child);
 
 /* --- EXPOSED FUNCTIONS --- */
 
@@ -36,6 +180,9 @@ reactor *create_reactor()
 {
     // I assume zero initialization of memory should result in integer=0 and points=NULL, always? ...
     reactor *r = calloc(1, sizeof(reactor));
+    if (r) {
+        r->base = r;
+    }
     return r;
 }
 
@@ -46,7 +193,27 @@ void destroy_reactor(reactor *r)
         fprintf(stderr, "Invalid input given\n");
         exit(1);
     }
+    if (atomic_load(&r->nr_of_forks) > 0) {
+        fprintf(stderr, "Sorry! Reactor still has forks, destroy them first\n");
+        exit(1);
+    }
+
+    if (r->fork_parent) {
+        // a fork only owns its changed values
+        for (unsigned int i = 0; i < r->nr_of_chunks; i++) {
+            if (r->chunks[i] && r->chunks[i]->owner == r) {
+                free(r->chunks[i]);
+            }
+        }
+        free(r->chunks);
+        atomic_fetch_sub(&r->fork_parent->nr_of_forks, 1);
+        free(r);
+        return;
+    }
 
+    while (r->subscriptions) {
+        reactor_unsubscribe(r, r->subscriptions->id);
+    }
     // free all cells and callbacks
     cell *top_parent = r->first_parent;
     cell *next_top_parent;
@@ -55,186 +222,1456 @@ void destroy_reactor(reactor *r)
         all_delete(top_parent);
         top_parent = next_top_parent;
     }
-    // free reactor
+    // stop worker threads and free reactor
+    thread_pool_destroy(r->pool);
+    reactor_stop_recording(r);
+    free(r->changes.changes);
+    free(r->filtered_changes.changes);
+    free(r->undo_log);
+    free(r->speculative_records);
+    free(r->consed_cells);
+    free(r->component_ranks);
+    free(r->components);
+    free(r->cells);
+    while (r->slabs) {
+        slab *next = r->slabs->next;
+        free(r->slabs);
+        r->slabs = next;
+    }
     free(r);
 }
 
 // add top-level parent
 cell *create_input_cell(reactor *r, int initial_value)
+{
+    if (!r || r->fork_parent) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    return add_input_cell(r, initial_value);
+}
+
+// add new child to a parent
+cell *create_compute1_cell(reactor *r, cell *c, compute1 compute1)
+{
+    if (!r || !c || !compute1 || r != c->reactor || r->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    return add_compute_cell(r, c, NULL, compute1, NULL);
+}
+
+// add the same new child to two parents
+cell *create_compute2_cell(reactor *r, cell *c1, cell *c2, compute2 compute2)
+{
+    if (!r || !c1 || !c2 || !compute2 || r != c1->reactor || r != c2->reactor || r->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    return add_compute_cell(r, c1, c2, NULL, compute2);
+}
+
+int get_cell_value(cell *c)
+{
+    if (!c) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    return refresh_value(c->reactor, c);
+}
+
+void set_cell_value(cell *c, int new_value)
+{
+    if (!c) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(c->reactor);
+    record_update(c->reactor, c, new_value);
+    set_and_propagate(c->reactor, c, new_value);
+}
+
+/*
+ * Set multiple input cells, then propagate all the changes together.
+ *
+ * The changed cells are grouped per component (cells connected through compute cells),
+ *  each component is propagated on its own and if there are several, on the reactor's thread pool.
+ * All cells must belong to the same reactor, if the same cell is given twice the last value is used.
+ */
+void set_cell_values(cell **cells, const int *new_values, size_t nr_of_values)
+{
+    if (!cells || !new_values || nr_of_values == 0 || !cells[0]) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    reactor *r = cells[0]->reactor;
+    for (size_t i = 0; i < nr_of_values; i++) {
+        if (!cells[i] || cells[i]->reactor != r) {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+    }
+    check_not_frozen(r);
+    r->update_nr++;
+
+    for (size_t i = 0; i < nr_of_values; i++) {
+        record_update(r, cells[i], new_values[i]);
+        cells[i]->new_value = new_values[i];
+    }
+
+    pending_update *updates = malloc(nr_of_values * sizeof(pending_update));
+    cell **inputs = malloc(nr_of_values * sizeof(cell *));
+    propagation *groups = malloc(nr_of_values * sizeof(propagation));
+    if (!updates || !inputs || !groups) {
+        exit(1);
+    }
+
+    // find the component of each changed cell, then sort so that each component is in one consecutive run
+    size_t nr_of_updates = 0;
+    for (size_t i = 0; i < nr_of_values; i++) {
+        if (cells[i]->value != cells[i]->new_value) {
+            updates[nr_of_updates].root = component_root(r, cells[i]->index);
+            updates[nr_of_updates].input = cells[i];
+            nr_of_updates++;
+        }
+    }
+    qsort(updates, nr_of_updates, sizeof(pending_update), compare_pending_updates);
+
+    size_t nr_of_groups = 0;
+    for (size_t i = 0; i < nr_of_updates; i++) {
+        inputs[i] = updates[i].input;
+        if (i == 0 || updates[i].root != updates[i - 1].root) {
+            groups[nr_of_groups].reactor = r;
+            groups[nr_of_groups].inputs = &inputs[i];
+            groups[nr_of_groups].nr_of_inputs = 0;
+            groups[nr_of_groups].changes = NULL;
+            nr_of_groups++;
+        }
+        groups[nr_of_groups - 1].nr_of_inputs++;
+    }
+
+    if (nr_of_groups > 1 && r->nr_of_threads > 1 && !r->pool) {
+        r->pool = thread_pool_create(r->nr_of_threads);
+    }
+    // (the undo log is not shared between threads, so when speculating we go through the components one at a time)
+    if (nr_of_groups > 1 && r->pool && !r->speculating) {
+        // each thread collects changes in its own list, afterwards we add them to the reactor's list
+        change_list *lists = NULL;
+        if (r->subscriptions) {
+            lists = calloc(nr_of_groups, sizeof(change_list));
+            if (!lists) {
+                exit(1);
+            }
+            for (size_t i = 0; i < nr_of_groups; i++) {
+                groups[i].changes = &lists[i];
+            }
+        }
+        thread_pool_run(r->pool, nr_of_groups, propagate_task, groups);
+        for (size_t i = 0; lists && i < nr_of_groups; i++) {
+            for (size_t k = 0; k < lists[i].length; k++) {
+                add_change(&r->changes, lists[i].changes[k].cell, lists[i].changes[k].old_value,
+                           lists[i].changes[k].new_value);
+            }
+            free(lists[i].changes);
+        }
+        free(lists);
+    } else {
+        for (size_t i = 0; i < nr_of_groups; i++) {
+            groups[i].changes = r->subscriptions ? &r->changes : NULL;
+            propagate(&groups[i]);
+        }
+    }
+    deliver_changes(r);
+
+    free(groups);
+    free(inputs);
+    free(updates);
+}
+
+void reactor_set_threads(reactor *r, unsigned int nr_of_threads)
+{
+    if (!r || nr_of_threads == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    if (r->nr_of_threads == nr_of_threads) {
+        return;
+    }
+    // (re-)start threads later, when actually needed
+    thread_pool_destroy(r->pool);
+    r->pool = NULL;
+    r->nr_of_threads = nr_of_threads;
+}
+
+void reactor_begin_speculation(reactor *r)
+{
+    if (!r || r->speculating || r->fork_parent) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    r->speculating = true;
+    r->speculation_nr++;
+    r->undo_log_length = 0;
+}
+
+// restore old values in reverse order, so the last value written to a cell is its value from before the speculation
+void reactor_rollback(reactor *r)
+{
+    if (!r || !r->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    for (size_t i = r->undo_log_length; i > 0; i--) {
+        undo_entry *entry = &r->undo_log[i - 1];
+        if (entry->slot) {
+            aggregate_set(entry->cell->aggregate, entry->slot - 1, entry->old_value);
+            continue;
+        }
+        entry->cell->value = entry->old_value;
+        entry->cell->new_value = entry->old_value;
+    }
+    r->speculating = false;
+    r->nr_of_speculative_records = 0;  // (the updates never took effect)
+    r->update_nr++;
+    // a cell which became live during the speculation was computed from speculative values, compute it again
+    for (size_t i = 0; i < r->undo_log_length; i++) {
+        undo_entry *entry = &r->undo_log[i];
+        if (entry->refreshed && entry->cell->live) {
+            recompute(r, entry->cell);
+        }
+    }
+    r->undo_log_length = 0;
+}
+
+// keep speculative values, now invoke the callbacks we skipped (once per cell, and only if the value changed)
+void reactor_commit(reactor *r)
+{
+    if (!r || !r->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    r->speculating = false;
+    write_records(r, r->speculative_records, r->nr_of_speculative_records);
+    r->nr_of_speculative_records = 0;
+    for (size_t i = 0; i < r->undo_log_length; i++) {
+        undo_entry *entry = &r->undo_log[i];
+        if (entry->slot || entry->cell->value == entry->old_value) {
+            continue;
+        }
+        if (entry->cell->cb_st) {
+            run_callbacks(entry->cell->cb_st, entry->cell->value);
+        }
+        if (r->subscriptions) {
+            add_change(&r->changes, entry->cell, entry->old_value, entry->cell->value);
+        }
+    }
+    r->undo_log_length = 0;
+    deliver_changes(r);
+}
+
+/*
+ * Fork reactor r (which may itself be a fork), the fork starts out with the same values as r.
+ *
+ * A fork has its own list of value chunks, where each chunk is either shared (with the base reactor or a parent fork)
+ *  or owned by the fork. Before a fork changes a value in a chunk not owned by it, the chunk is copied.
+ * Since the parents are frozen while they have forks, shared chunks never change under our feet.
+ */
+reactor *reactor_fork(reactor *r)
+{
+    if (!r || r->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+
+    reactor *fork = calloc(1, sizeof(reactor));
+    if (!fork) {
+        return NULL;
+    }
+    fork->base = r->base;
+    fork->fork_parent = r;
+    fork->nr_of_chunks = (r->base->nr_of_cells + REACTOR_CHUNK_SIZE - 1) / REACTOR_CHUNK_SIZE;
+    fork->chunks = calloc(fork->nr_of_chunks ? fork->nr_of_chunks : 1, sizeof(value_chunk *));
+    if (!fork->chunks) {
+        free(fork);
+        return NULL;
+    }
+    if (r->fork_parent) {
+        // start out sharing all chunks of parent fork
+        memcpy(fork->chunks, r->chunks, r->nr_of_chunks * sizeof(value_chunk *));
+    }
+    atomic_fetch_add(&r->nr_of_forks, 1);
+    return fork;
+}
+
+int reactor_get_cell_value(reactor *r, cell *c)
+{
+    if (!r || !c || c->reactor != r->base) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    return refresh_value(r, c);
+}
+
+void reactor_set_cell_value(reactor *r, cell *c, int new_value)
+{
+    if (!r || !c || c->reactor != r->base) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    record_update(r, c, new_value);
+    set_and_propagate(r, c, new_value);
+}
+
+int reactor_start_recording(reactor *r, const char *file_name)
+{
+    if (!r || !file_name || r->fork_parent) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    reactor_stop_recording(r);
+
+    r->recording = fopen(file_name, "wb");
+    if (!r->recording) {
+        return 1;
+    }
+    if (fwrite(REACTOR_LOG_MAGIC, REACTOR_LOG_MAGIC_SIZE, 1, r->recording) != 1) {
+        reactor_stop_recording(r);
+        return 1;
+    }
+    return 0;
+}
+
+void reactor_stop_recording(reactor *r)
 {
     if (!r) {
         fprintf(stderr, "Invalid input given\n");
         exit(1);
     }
+    if (r->recording) {
+        fclose(r->recording);
+        r->recording = NULL;
+    }
+    r->nr_of_speculative_records = 0;
+}
 
-    cell *c = calloc(1, sizeof(cell));
-    c->reactor = r;
-    c->value = initial_value;
-    c->new_value = c->value;
-    c->nr_of_children = 0;
+/*
+ * Subscribe to changes, the filter (if any) is copied and sorted so we can look up cells quickly.
+ */
+subscription_id reactor_subscribe(reactor *r, cell **filter, size_t nr_of_cells, void *data, change_feed func)
+{
+    if (!r || !func || r->fork_parent || (!filter && nr_of_cells > 0) || (filter && nr_of_cells == 0)) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < nr_of_cells; i++) {
+        if (!filter[i] || filter[i]->reactor != r) {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+    }
+    if (r->next_subscription_id == INT_MAX) {
+        fprintf(stderr, "Sorry! Subscriptions full, have already %d\n", r->next_subscription_id);
+        return 0;
+    }
+    check_not_frozen(r);
 
-    if (r->first_parent == NULL) {
-        r->first_parent = c;
+    subscription *sub = calloc(1, sizeof(subscription));
+    if (!sub) {
+        exit(1);
+    }
+    if (filter) {
+        sub->filter = malloc(nr_of_cells * sizeof(cell *));
+        if (!sub->filter) {
+            exit(1);
+        }
+        memcpy(sub->filter, filter, nr_of_cells * sizeof(cell *));
+        qsort(sub->filter, nr_of_cells, sizeof(cell *), compare_cells);
+        sub->filter_length = nr_of_cells;
+    }
+    sub->id = r->next_subscription_id++;
+    sub->func = func;
+    sub->data = data;
+
+    // the cells we report changes for must be live, without filter that is all cells
+    if (!filter) {
+        if (r->nr_of_unfiltered_subscriptions == 0) {
+            // bring the dead cells up to date, from now on they are recomputed as well
+            for (unsigned int i = 0; i < r->nr_of_cells; i++) {
+                if (r->cells[i]) {
+                    refresh_value(r, r->cells[i]);
+                }
+            }
+        }
+        r->nr_of_unfiltered_subscriptions++;
+    }
+    for (size_t i = 0; i < nr_of_cells; i++) {
+        pin_cell(filter[i]);
+    }
+
+    // add last, subscribers get changes in the order they subscribed
+    subscription **last = &r->subscriptions;
+    while (*last) {
+        last = &(*last)->next;
+    }
+    *last = sub;
+    return sub->id;
+}
+
+void reactor_unsubscribe(reactor *r, subscription_id id)
+{
+    if (!r) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    for (subscription **sub = &r->subscriptions; *sub; sub = &(*sub)->next) {
+        if ((*sub)->id == id) {
+            subscription *matching_sub = *sub;
+            check_not_frozen(r);
+            *sub = matching_sub->next;
+            if (!matching_sub->filter) {
+                r->nr_of_unfiltered_subscriptions--;
+            }
+            for (size_t i = 0; i < matching_sub->filter_length; i++) {
+                unpin_cell(matching_sub->filter[i]);
+            }
+            free(matching_sub->filter);
+            free(matching_sub);
+            return;
+        }
+    }
+}
+
+void reactor_enable_hash_consing(reactor *r)
+{
+    if (!r || r->fork_parent) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    if (r->hash_consing) {
+        return;
+    }
+    r->hash_consing = true;
+    // existing compute cells may be reused as well
+    for (unsigned int i = 0; i < r->nr_of_cells; i++) {
+        if (r->cells[i] && (r->cells[i]->compute1 || r->cells[i]->compute2)) {
+            consed_insert(r, r->cells[i]);
+        }
+    }
+}
+
+/*
+ * Release a compute cell, once released as many times as it was created it is deleted.
+ *  The cell may not have children (they need it), then it is kept and a message is printed.
+ */
+void release_cell(cell *c)
+{
+    if (!c || !is_compute_cell(c) || c->reactor->speculating) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    reactor *r = c->reactor;
+    check_not_frozen(r);
+
+    if (c->refs > 1) {
+        c->refs--;
+        return;
+    }
+    if (c->nr_of_children > 0) {
+        fprintf(stderr, "Sorry! Cell still has %u children and can not be deleted\n", c->nr_of_children);
+        return;
+    }
+
+    // deleted cell may not be matched by filter (the memory may be reused by a new cell)
+    for (subscription *sub = r->subscriptions; sub; sub = sub->next) {
+        cell **match;
+        while (sub->filter &&
+               (match = bsearch(&c, sub->filter, sub->filter_length, sizeof(cell *), compare_cells))) {
+            memmove(match, match + 1, (size_t)(sub->filter + sub->filter_length - (match + 1)) * sizeof(cell *));
+            sub->filter_length--;
+        }
+    }
+    // no longer observed, its parents may become dead
+    destroy_cell_callbacks(c);
+    c->pins = 0;
+    update_liveness(c);
+
+    if (r->hash_consing) {
+        consed_remove(r, c);
+    }
+    for (unsigned int k = 0; k < nr_of_parents(c); k++) {
+        compute_cell_remove_child(get_parent(c, k), c);
+    }
+    r->cells[c->index] = NULL;
+    free_cell(c);
+}
+
+cell *create_memo_compute1_cell(reactor *r, cell *c, compute1 compute1, unsigned int memo_size)
+{
+    if (memo_size == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    cell *child = create_compute1_cell(r, c, compute1);
+    if (child && !child->memo) {
+        enable_memo(child, memo_size);
+    }
+    return child;
+}
+
+cell *create_memo_compute2_cell(reactor *r, cell *c1, cell *c2, compute2 compute2, unsigned int memo_size)
+{
+    if (memo_size == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    cell *child = create_compute2_cell(r, c1, c2, compute2);
+    if (child && !child->memo) {
+        enable_memo(child, memo_size);
+    }
+    return child;
+}
+
+void get_cell_memo_stats(cell *c, unsigned long *hits, unsigned long *misses)
+{
+    if (!c || !hits || !misses) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    *hits = c->memo_hits;
+    *misses = c->memo_misses;
+}
+
+// note: one cell can have multiple callbacks
+callback_id add_callback(cell *cell, void *cb_data, callback cb)
+{
+    if (!cell || !cb) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(cell->reactor);
+    if (cell->reactor->next_cb_id == INT_MAX) {
+        fprintf(stderr, "Sorry! Callbacks full, have already %d\n", cell->reactor->next_cb_id);
+        return 0;
+    }
+
+    callback_st *cb_st = calloc(1, sizeof(callback_st));
+    cb_st->data = cb_data;
+    cb_st->func = cb;
+    cb_st->id = cell->reactor->next_cb_id++;
+    cb_st->next_cb_st = NULL;  // we are last in list
+
+    // first callback on cell, cell point to us directly
+    if (cell->cb_st == NULL) {
+        cell->cb_st = cb_st;
+        // otherwise, previous cb in list should point to us, not null
+    } else {
+        callback_st *tmp = cell->cb_st;
+        while (tmp->next_cb_st) {
+            tmp = tmp->next_cb_st;
+        }
+        tmp->next_cb_st = cb_st;
+    }
+    update_liveness(cell);
+    return cb_st->id;
+}
+
+/*
+ * Remove a single callback (cb_st) from cell, matching the id.
+ *  (cb_st is a linked list of one or multiple cb_st)
+ */
+void remove_callback(cell *c, callback_id id)
+{
+    callback_st *cb_st, *cb_st_previous, *matching_cb;
+    if (!c) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    if (!c->cb_st) return;
+    check_not_frozen(c->reactor);
+
+    // check first element in cb_st
+    if (c->cb_st->id == id) {
+        matching_cb = c->cb_st;
+        // put second element in list first (element is be NULL if matching_cb was only element in list)
+        c->cb_st = matching_cb->next_cb_st;
+        free(matching_cb);
+        update_liveness(c);
+        return;
+    }
+
+    // otherwise check rest of list
+    cb_st_previous = c->cb_st;
+    cb_st = c->cb_st->next_cb_st;
+    while (cb_st) {
+        if (cb_st->id == id) {
+            matching_cb = cb_st;
+            // point previous cb_st to the one after matching entry (points to NULL if last)
+            cb_st_previous->next_cb_st = matching_cb->next_cb_st;
+            free(matching_cb);
+            return;
+        }
+        cb_st_previous = cb_st;
+        cb_st = cb_st->next_cb_st;
+    }
+}
+
+void pin_cell(cell *c)
+{
+    if (!c) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(c->reactor);
+    if (c->pins == UINT_MAX) {
+        fprintf(stderr, "Sorry! Cell has already been pinned %u times\n", c->pins);
+        return;
+    }
+    c->pins++;
+    update_liveness(c);
+}
+
+void unpin_cell(cell *c)
+{
+    if (!c || c->pins == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(c->reactor);
+    c->pins--;
+    update_liveness(c);
+}
+
+/*
+ * Aggregate cell: the parents are kept once each (with multiplicity) and found through a hash table,
+ *  so that the value a changed parent had before can be taken out of the aggregate.
+ */
+cell *create_aggregate_cell(reactor *r, enum aggregate_kind kind, cell **parents, size_t nr_of_parents)
+{
+    if (!r || r->fork_parent || r->speculating || !parents || nr_of_parents == 0 || nr_of_parents > UINT_MAX ||
+        kind < AGGREGATE_SUM || kind > AGGREGATE_MAX) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < nr_of_parents; i++) {
+        if (!parents[i] || parents[i]->reactor != r) {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+    }
+    check_not_frozen(r);
+    for (size_t i = 0; i < nr_of_parents; i++) {
+        if (parents[i]->nr_of_children == UINT_MAX) {
+            fprintf(stderr, "Sorry! Parent is full and has already %u children\n", parents[i]->nr_of_children);
+            return NULL;
+        }
+    }
+
+    aggregate *a = calloc(1, sizeof(aggregate));
+    if (!a) {
+        exit(1);
+    }
+    a->kind = kind;
+    a->slots_size = 4;
+    while (a->slots_size < 2 * nr_of_parents) {
+        a->slots_size *= 2;
+    }
+    a->parents = malloc(nr_of_parents * sizeof(aggregate_parent));
+    a->slots = calloc(a->slots_size, sizeof(unsigned int));
+    if (!a->parents || !a->slots) {
+        exit(1);
+    }
+    for (size_t i = 0; i < nr_of_parents; i++) {
+        aggregate_add_parent(a, parents[i]);
+    }
+    if (kind == AGGREGATE_MIN || kind == AGGREGATE_MAX) {
+        a->tree_size = 1;
+        while (a->tree_size < a->nr_of_parents) {
+            a->tree_size *= 2;
+        }
+        a->tree = malloc(2 * a->tree_size * sizeof(int));
+        if (!a->tree) {
+            exit(1);
+        }
+    }
+
+    cell *c = alloc_cell(r);
+    add_to_cells(r, c);
+    c->reactor = r;
+    c->aggregate = a;
+    for (unsigned int k = 0; k < a->nr_of_parents; k++) {
+        compute_cell_add_child(r, a->parents[k].cell, c);
+        component_union(r, c->index, a->parents[k].cell->index);
+    }
+    c->value = aggregate_recompute(r, c, true, false);
+    c->new_value = c->value;
+    c->refresh_nr = r->update_nr;
+    c->refs = 1;
+    return c;
+}
+
+/*
+ * Reserve memory for cells and their lists of children (edges) in one slab, cells are taken from it until it is full.
+ *  (The slab is freed with the reactor, also the memory of cells released before then)
+ */
+int reactor_reserve(reactor *r, size_t nr_of_cells, size_t nr_of_edges)
+{
+    if (!r || r->fork_parent) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    check_not_frozen(r);
+    if (reserve_cells(r, nr_of_cells) != 0) {
+        return 1;
+    }
+
+    // every cell and list of children is rounded up to the alignment
+    const size_t align = _Alignof(max_align_t);
+    size_t cell_size = (sizeof(cell) + align - 1) / align * align;
+    if (nr_of_edges > (SIZE_MAX / 2 - sizeof(slab)) / sizeof(cell *) ||
+        nr_of_cells > (SIZE_MAX / 2 - sizeof(slab)) / (cell_size + align)) {
+        fprintf(stderr, "Sorry! Can not reserve room for %zu cells and %zu edges\n", nr_of_cells, nr_of_edges);
+        return 1;
+    }
+    size_t size = nr_of_cells * (cell_size + align) + nr_of_edges * sizeof(cell *);
+    if (size == 0 || (r->slabs && r->slabs->size - r->slabs->used >= size)) {
+        return 0;
+    }
+    slab *s = calloc(1, sizeof(slab) + size);
+    if (!s) {
+        fprintf(stderr, "Sorry! Could not reserve %zu bytes\n", size);
+        return 1;
+    }
+    s->size = size;
+    s->next = r->slabs;
+    r->slabs = s;
+    return 0;
+}
+
+int reactor_add_cells(reactor *r, const cell_spec *specs, size_t nr_of_specs, cell **out)
+{
+    return reactor_instantiate(r, specs, nr_of_specs, 1, out);
+}
+
+/*
+ * Create cells of all copies at once: the specs are checked once,
+ *  and memory for all cells and lists of children is reserved up front (counting the children of each cell first,
+ *  and of the existing parents).
+ * Cells are created in order, so the initial value of a compute cell is computed after its parents'.
+ */
+int reactor_instantiate(reactor *r, const cell_spec *specs, size_t nr_of_specs, size_t nr_of_copies, cell **out)
+{
+    if (!r || r->fork_parent || r->speculating || !specs || !out || nr_of_specs == 0 || nr_of_copies == 0) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < nr_of_specs; i++) {
+        if (!is_valid_spec(r, specs, i)) {
+            fprintf(stderr, "Invalid input given\n");
+            exit(1);
+        }
+    }
+    check_not_frozen(r);
+    if (nr_of_copies > SIZE_MAX / nr_of_specs / (2 * sizeof(cell *))) {
+        fprintf(stderr, "Sorry! Can not create %zu copies of %zu cells\n", nr_of_copies, nr_of_specs);
+        return 1;
+    }
+
+    // count children of each cell in one copy, the existing parents are sorted to count them per cell as well
+    size_t *nr_of_children = calloc(nr_of_specs, sizeof(size_t));
+    cell **existing_parents = malloc(2 * nr_of_specs * sizeof(cell *));
+    size_t nr_of_existing_parents = 0, nr_of_edges = 0;
+    if (!nr_of_children || !existing_parents) {
+        exit(1);
+    }
+    for (size_t i = 0; i < nr_of_specs; i++) {
+        unsigned int nr_of_parents =
+            specs[i].kind == CELL_SPEC_COMPUTE2 ? 2 : specs[i].kind == CELL_SPEC_COMPUTE1 ? 1 : 0;
+        for (unsigned int k = 0; k < nr_of_parents; k++) {
+            if (specs[i].parent_cells[k]) {
+                existing_parents[nr_of_existing_parents++] = specs[i].parent_cells[k];
+            } else {
+                nr_of_children[specs[i].parent_specs[k]]++;
+                nr_of_edges++;
+            }
+        }
+    }
+    qsort(existing_parents, nr_of_existing_parents, sizeof(cell *), compare_cells);
+
+    // the lists of children of existing parents grow in the slab as well (each rounded up to the alignment)
+    const size_t per_align = _Alignof(max_align_t) / sizeof(cell *);
+    size_t nr_of_existing_edges = 0;
+    int rv = 1;
+    for (size_t i = 0, run; i < nr_of_existing_parents; i += run) {
+        run = run_length(existing_parents, nr_of_existing_parents, i);
+        if (run * nr_of_copies > UINT_MAX - existing_parents[i]->nr_of_children) {
+            fprintf(stderr, "Sorry! Parent is full and has already %u children\n", existing_parents[i]->nr_of_children);
+            goto cleanup;
+        }
+        nr_of_existing_edges += (existing_parents[i]->nr_of_children + run * nr_of_copies + per_align - 1) / per_align *
+                                per_align;
+    }
+    if (reactor_reserve(r, nr_of_specs * nr_of_copies, nr_of_edges * nr_of_copies + nr_of_existing_edges) != 0) {
+        goto cleanup;
+    }
+    for (size_t i = 0, run; i < nr_of_existing_parents; i += run) {
+        run = run_length(existing_parents, nr_of_existing_parents, i);
+        reserve_children(r, existing_parents[i], existing_parents[i]->nr_of_children + run * nr_of_copies);
+    }
+
+    for (size_t copy = 0; copy < nr_of_copies; copy++) {
+        cell **cells = &out[copy * nr_of_specs];
+        for (size_t i = 0; i < nr_of_specs; i++) {
+            const cell_spec *spec = &specs[i];
+            cell *parents[2] = {NULL, NULL};
+            for (unsigned int k = 0; spec->kind != CELL_SPEC_INPUT && k < 2; k++) {
+                parents[k] = spec->parent_cells[k] ? spec->parent_cells[k] : cells[spec->parent_specs[k]];
+            }
+            if (spec->kind == CELL_SPEC_INPUT) {
+                cells[i] = add_input_cell(r, spec->value);
+            } else if (spec->kind == CELL_SPEC_COMPUTE1) {
+                cells[i] = add_compute_cell(r, parents[0], NULL, spec->compute1, NULL);
+            } else {
+                cells[i] = add_compute_cell(r, parents[0], parents[1], NULL, spec->compute2);
+            }
+            if (!cells[i]) {
+                goto cleanup;
+            }
+            reserve_children(r, cells[i], cells[i]->nr_of_children + nr_of_children[i]);
+        }
+    }
+    rv = 0;
+cleanup:
+    free(existing_parents);
+    free(nr_of_children);
+    return rv;
+}
+
+/* --- INTERNAL FUNCTIONS --- */
+
+// a reactor with forks, or any of its cells, may not be modified (the forks depend on it)
+static void check_not_frozen(reactor *r)
+{
+    if (atomic_load(&r->nr_of_forks) > 0) {
+        fprintf(stderr, "Sorry! Reactor has forks and can not be modified\n");
+        exit(1);
+    }
+}
+
+// add input cell to the end of the list of top-level parents
+static cell *add_input_cell(reactor *r, int initial_value)
+{
+    cell *c = alloc_cell(r);
+    add_to_cells(r, c);
+    c->reactor = r;
+    c->value = initial_value;
+    c->new_value = c->value;
+    c->nr_of_children = 0;
+    c->refs = 1;
+    c->input_index = r->nr_of_inputs++;
+
+    if (r->first_parent == NULL) {
+        r->first_parent = c;
+    } else {
+        // old last parent point to us
+        r->last_parent->next_parent = c;
+    }
+    r->last_parent = c;
+
+    return c;
+}
+
+// add compute cell with parent c1 (and c2 if compute2), with hash-consing it may be an existing cell
+static cell *add_compute_cell(reactor *r, cell *c1, cell *c2, compute1 compute1, compute2 compute2)
+{
+    if (r->hash_consing) {
+        cell *existing = retain_consed(r, c1, c2, compute1, compute2);
+        if (existing) {
+            return existing;
+        }
+    }
+    if (c1->nr_of_children == UINT_MAX || (c2 && c2->nr_of_children >= UINT_MAX - (c1 == c2))) {
+        fprintf(stderr, "Sorry! Parent is full and has already %u children\n", UINT_MAX);
+        return NULL;
+    }
+
+    // add child to (its first) parent, and the same child pointer to its other parent
+    cell *child = alloc_cell(r);
+    add_to_cells(r, child);
+    child->reactor = r;
+    compute_cell_add_child(r, c1, child);
+    component_union(r, child->index, c1->index);
+    child->parents[0] = c1;
+    if (c2) {
+        compute_cell_add_child(r, c2, child);
+        component_union(r, child->index, c2->index);
+        child->parents[1] = c2;
+    }
+    child->compute1 = compute1;
+    child->compute2 = compute2;
+    if (compute1) {
+        child->value = compute1(refresh_value(r, c1));
+    } else {
+        child->value = compute2(refresh_value(r, c1), refresh_value(r, c2));
+    }
+    child->new_value = child->value;
+    child->refresh_nr = r->update_nr;
+    child->refs = 1;
+    if (r->hash_consing) {
+        consed_insert(r, child);
+    }
+
+    return child;
+}
+
+// a compute cell needs its function, and its parents must be cells in r or earlier in the list
+static bool is_valid_spec(reactor *r, const cell_spec *specs, size_t spec_nr)
+{
+    const cell_spec *spec = &specs[spec_nr];
+    unsigned int nr_of_parents;
+    switch (spec->kind) {
+        case CELL_SPEC_INPUT:
+            return true;
+        case CELL_SPEC_COMPUTE1:
+            nr_of_parents = 1;
+            if (!spec->compute1) {
+                return false;
+            }
+            break;
+        case CELL_SPEC_COMPUTE2:
+            nr_of_parents = 2;
+            if (!spec->compute2) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    for (unsigned int k = 0; k < nr_of_parents; k++) {
+        if (spec->parent_cells[k] ? spec->parent_cells[k]->reactor != r : spec->parent_specs[k] >= spec_nr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// add new cell to list of all cells in reactor (it starts out as its own component)
+static void add_to_cells(reactor *r, cell *c)
+{
+    if (r->nr_of_cells == r->cells_size && reserve_cells(r, r->cells_size ? r->cells_size : 64) != 0) {
+        exit(1);
+    }
+    c->index = r->nr_of_cells;
+    r->cells[c->index] = c;
+    r->components[c->index] = c->index;
+    r->component_ranks[c->index] = 0;
+    r->nr_of_cells++;
+}
+
+// make room for nr_of_cells more cells in list of all cells, returns 0 on success
+static int reserve_cells(reactor *r, size_t nr_of_cells)
+{
+    if (nr_of_cells > UINT_MAX - r->nr_of_cells) {
+        fprintf(stderr, "Sorry! Reactor is full and has already %u cells\n", r->nr_of_cells);
+        return 1;
+    }
+    if (r->nr_of_cells + nr_of_cells <= r->cells_size) {
+        return 0;
+    }
+    unsigned int new_size = r->nr_of_cells + (unsigned int)nr_of_cells;
+    cell **cells = realloc(r->cells, new_size * sizeof(cell *));
+    unsigned int *components = realloc(r->components, new_size * sizeof(unsigned int));
+    unsigned char *component_ranks = realloc(r->component_ranks, new_size);
+    if (!cells || !components || !component_ranks) {
+        exit(1);
+    }
+    r->cells = cells;
+    r->components = components;
+    r->component_ranks = component_ranks;
+    r->cells_size = new_size;
+    return 0;
+}
+
+// take size bytes from the latest slab, NULL if there is no room left
+static void *slab_alloc(reactor *r, size_t size)
+{
+    slab *s = r->slabs;
+    size = (size + _Alignof(max_align_t) - 1) / _Alignof(max_align_t) * _Alignof(max_align_t);
+    if (!s || s->size - s->used < size) {
+        return NULL;
+    }
+    void *memory = (unsigned char *)s->memory + s->used;
+    s->used += size;
+    return memory;
+}
+
+// zero initialized cell, from slab if there is room
+static cell *alloc_cell(reactor *r)
+{
+    cell *c = slab_alloc(r, sizeof(cell));
+    if (c) {
+        c->in_slab = true;
+        return c;
+    }
+    c = calloc(1, sizeof(cell));
+    if (!c) {
+        exit(1);
+    }
+    return c;
+}
+
+static void free_cell(cell *c)
+{
+    free(c->memo);
+    free_aggregate(c->aggregate);
+    if (!c->in_slab) {
+        free(c);
+    }
+}
+
+// make room for (at least) size children, from slab if there is room
+static void reserve_children(reactor *r, cell *c, size_t size)
+{
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+    if (size <= c->children_size) {
+        return;
+    }
+    cell **children = slab_alloc(r, size * sizeof(cell *));
+    bool in_slab = children != NULL;
+    if (!children) {
+        children = malloc(size * sizeof(cell *));
+        if (!children) {
+            exit(1);
+        }
+    }
+    if (c->nr_of_children > 0) {
+        memcpy(children, c->children, c->nr_of_children * sizeof(cell *));
+    }
+    free_children(c);
+    c->children = children;
+    c->children_size = (unsigned int)size;
+    c->children_in_slab = in_slab;
+}
+
+// free list of children (nr_of_children is left as is)
+static void free_children(cell *c)
+{
+    if (!c->children_in_slab) {
+        free(c->children);
+    }
+    c->children = NULL;
+    c->children_size = 0;
+    c->children_in_slab = false;
+}
+
+// append update of an input cell to the log, if recording (see react_replay.c),
+//  while speculating it is kept until the speculation is committed (or dropped when it is rolled back)
+static void record_update(reactor *r, cell *c, int new_value)
+{
+    if (!r->recording || is_compute_cell(c)) {
+        return;
+    }
+    reactor_log_record record = {.input_index = c->input_index, .value = new_value};
+    if (!r->speculating) {
+        write_records(r, &record, 1);
+        return;
+    }
+    if (r->nr_of_speculative_records == r->speculative_records_size) {
+        size_t new_size = r->speculative_records_size ? r->speculative_records_size * 2 : 64;
+        reactor_log_record *records = realloc(r->speculative_records, new_size * sizeof(reactor_log_record));
+        if (!records) {
+            exit(1);
+        }
+        r->speculative_records = records;
+        r->speculative_records_size = new_size;
+    }
+    r->speculative_records[r->nr_of_speculative_records++] = record;
+}
+
+static void write_records(reactor *r, const reactor_log_record *records, size_t nr_of_records)
+{
+    if (!r->recording || nr_of_records == 0) {
+        return;
+    }
+    if (fwrite(records, sizeof(reactor_log_record), nr_of_records, r->recording) != nr_of_records) {
+        fprintf(stderr, "Sorry! Failed to write recording, stopped recording\n");
+        reactor_stop_recording(r);
+    }
+}
+
+static void add_change(change_list *list, cell *c, int old_value, int new_value)
+{
+    if (list->length == list->size) {
+        size_t new_size = list->size ? list->size * 2 : 64;
+        cell_change *changes = realloc(list->changes, new_size * sizeof(cell_change));
+        if (!changes) {
+            exit(1);
+        }
+        list->changes = changes;
+        list->size = new_size;
+    }
+    list->changes[list->length].cell = c;
+    list->changes[list->length].old_value = old_value;
+    list->changes[list->length].new_value = new_value;
+    list->length++;
+}
+
+// give the changes collected in reactor to all subscribers (the ones with a filter only get matching cells)
+static void deliver_changes(reactor *r)
+{
+    const change_list *changes = &r->changes;
+    if (changes->length == 0) {
+        return;
+    }
+    for (subscription *sub = r->subscriptions; sub; sub = sub->next) {
+        if (!sub->filter) {
+            sub->func(sub->data, changes->changes, changes->length);
+            continue;
+        }
+        r->filtered_changes.length = 0;
+        for (size_t i = 0; i < changes->length; i++) {
+            const cell_change *change = &changes->changes[i];
+            if (bsearch(&change->cell, sub->filter, sub->filter_length, sizeof(cell *), compare_cells)) {
+                add_change(&r->filtered_changes, change->cell, change->old_value, change->new_value);
+            }
+        }
+        if (r->filtered_changes.length > 0) {
+            sub->func(sub->data, r->filtered_changes.changes, r->filtered_changes.length);
+        }
+    }
+    r->changes.length = 0;
+}
+
+// order cells by address, for sorted lists of cells
+static int compare_cells(const void *a, const void *b)
+{
+    uintptr_t cell_a = (uintptr_t)(*(cell *const *)a);
+    uintptr_t cell_b = (uintptr_t)(*(cell *const *)b);
+    return (cell_a > cell_b) - (cell_a < cell_b);
+}
+
+// number of cells equal to list[i] starting at i, in a sorted list of cells
+static size_t run_length(cell **list, size_t length, size_t i)
+{
+    size_t run = 1;
+    while (i + run < length && list[i + run] == list[i]) {
+        run++;
+    }
+    return run;
+}
+
+// set input cell c as seen by r (r is c->reactor or a fork of it) and propagate the change
+static void set_and_propagate(reactor *r, cell *c, int new_value)
+{
+    if (get_value(r, c) == new_value) {
+        return;  // done, no children have changed value either
+    }
+    set_new_value(r, c, new_value);
+    if (r == c->reactor) {
+        r->update_nr++;
+    }
+
+    propagation p = {.reactor = r, .inputs = &c, .nr_of_inputs = 1};
+    p.changes = r->subscriptions ? &r->changes : NULL;
+    propagate(&p);
+    deliver_changes(r);
+}
+
+/*
+ * Cell values: a reactor uses the values stored in its cells,
+ *  while a fork looks in its chunks first (if chunk is NULL, the value is the same as in the cell).
+ */
+static inline int get_value(reactor *r, cell *c)
+{
+    if (r == c->reactor) {
+        return c->value;
+    }
+    value_chunk *chunk = r->chunks[c->index >> REACTOR_CHUNK_BITS];
+    return chunk ? chunk->value[c->index & (REACTOR_CHUNK_SIZE - 1)] : c->value;
+}
+static inline int get_new_value(reactor *r, cell *c)
+{
+    if (r == c->reactor) {
+        return c->new_value;
+    }
+    value_chunk *chunk = r->chunks[c->index >> REACTOR_CHUNK_BITS];
+    return chunk ? chunk->new_value[c->index & (REACTOR_CHUNK_SIZE - 1)] : c->new_value;
+}
+static inline void set_value(reactor *r, cell *c, int value)
+{
+    if (r == c->reactor) {
+        c->value = value;
     } else {
-        // old last parent point to us
-        r->last_parent->next_parent = c;
+        writable_chunk(r, c)->value[c->index & (REACTOR_CHUNK_SIZE - 1)] = value;
     }
-    r->last_parent = c;
-
-    return c;
 }
-
-// add new child to a parent
-cell *create_compute1_cell(reactor *r, cell *c, compute1 compute1)
+static inline void set_new_value(reactor *r, cell *c, int new_value)
 {
-    if (!r || !c || !compute1 || r != c->reactor) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    if (r == c->reactor) {
+        c->new_value = new_value;
+    } else {
+        writable_chunk(r, c)->new_value[c->index & (REACTOR_CHUNK_SIZE - 1)] = new_value;
     }
-
-    cell *child;
-    child = compute_cell_add_child(c, NULL);
-    if (!child) {
-        return NULL;
-    }  // if this happens we are in trouble
-
-    child->reactor = r;
-    child->parents[0] = c;
-    child->compute1 = compute1;
-    child->value = child->compute1(c->value);
-    child->new_value = child->value;
-
-    return child;
 }
 
-// add the same new child to two parents
-cell *create_compute2_cell(reactor *r, cell *c1, cell *c2, compute2 compute2)
+// get chunk of fork r holding c, first copy it if the chunk is shared (copy-on-write)
+static value_chunk *writable_chunk(reactor *r, cell *c)
 {
-    if (!r || !c1 || !c2 || !compute2 || r != c1->reactor || r != c2->reactor) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    unsigned int chunk_nr = c->index >> REACTOR_CHUNK_BITS;
+    value_chunk *shared = r->chunks[chunk_nr];
+    if (shared && shared->owner == r) {
+        return shared;
     }
 
-    // allocate child and add its pointer to (its first) parent
-    cell *child;
-    child = compute_cell_add_child(c1, NULL);
-    if (!child) {
-        return NULL;
-    }  // if this happens we are in trouble
+    value_chunk *chunk = malloc(sizeof(value_chunk));
+    if (!chunk) {
+        exit(1);
+    }
+    chunk->owner = r;
+    if (shared) {
+        memcpy(chunk->value, shared->value, sizeof(chunk->value));
+        memcpy(chunk->new_value, shared->new_value, sizeof(chunk->new_value));
+    } else {
+        // copy from the cells themselves
+        reactor *base = r->base;
+        for (unsigned int i = 0; i < REACTOR_CHUNK_SIZE; i++) {
+            unsigned int index = chunk_nr * REACTOR_CHUNK_SIZE + i;
+            cell *cell = index < base->nr_of_cells ? base->cells[index] : NULL;
+            chunk->value[i] = cell ? cell->value : 0;
+            chunk->new_value[i] = cell ? cell->new_value : 0;
+        }
+    }
+    r->chunks[chunk_nr] = chunk;
+    return chunk;
+}
 
-    // add the same child pointer to its other parent (which points to same child in memory)
-    child = compute_cell_add_child(c2, child);
+// save old value of a cell (the first time it is changed during the current speculation)
+static void save_old_value(reactor *r, cell *c)
+{
+    if (c->speculation_nr == r->speculation_nr) {
+        return;  // already saved
+    }
+    append_undo_entry(r, c, c->value, 0);
+    c->speculation_nr = r->speculation_nr;
+}
 
-    child->reactor = r;
-    child->parents[0] = c1;
-    child->parents[1] = c2;
-    child->compute2 = compute2;
-    child->value = child->compute2(c1->value, c2->value);
-    child->new_value = child->value;
+// save the value of an aggregate's parent as seen by the aggregate, before it is changed (every time)
+static void save_old_slot(reactor *r, cell *c, unsigned int slot)
+{
+    append_undo_entry(r, c, c->aggregate->parents[slot].seen, slot + 1);
+}
 
-    return child;
+static void append_undo_entry(reactor *r, cell *c, int old_value, unsigned int slot)
+{
+    if (r->undo_log_length == r->undo_log_size) {
+        size_t new_size = r->undo_log_size ? r->undo_log_size * 2 : 64;
+        undo_entry *undo_log = realloc(r->undo_log, new_size * sizeof(undo_entry));
+        if (!undo_log) {
+            exit(1);
+        }
+        r->undo_log = undo_log;
+        r->undo_log_size = new_size;
+    }
+    r->undo_log[r->undo_log_length].cell = c;
+    r->undo_log[r->undo_log_length].old_value = old_value;
+    r->undo_log[r->undo_log_length].refreshed = false;
+    r->undo_log[r->undo_log_length].slot = slot;
+    r->undo_log_length++;
 }
 
-int get_cell_value(cell *c)
+// invoke all callbacks on a single cell (this should be called once whenever cell value has changed)
+static void run_callbacks(callback_st *cb_st, int new_value)
 {
-    if (!c) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    assert(cb_st);
+    cb_st->func(cb_st->data, new_value);
+
+    cb_st = cb_st->next_cb_st;
+    while (cb_st) {
+        cb_st->func(cb_st->data, new_value);
+        cb_st = cb_st->next_cb_st;
     }
-    return c->value;
 }
 
-void set_cell_value(cell *c, int new_value)
+/*
+ * Propagate the changed input cells of one component;
+ *  compute 'new_value' on all affected cells and only once all values have been propagated, we finalize by;
+ *  invoke callbacks and write 'new_value' to 'value'
+ *
+ * Every input must already have its new_value set, so that a compute cell with two changed parents
+ *  sees both changes already on the first pass (and we don't invoke callbacks for an intermediate value).
+ */
+static void propagate(propagation *p)
 {
-    if (!c) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    for (size_t i = 0; i < p->nr_of_inputs; i++) {
+        all_compute(p, p->inputs[i]);
     }
-    if (c->value == new_value) {
-        return;  // done, no children have changed value either
+    for (size_t i = 0; i < p->nr_of_inputs; i++) {
+        all_invoke(p, p->inputs[i]);
     }
+}
 
-    c->new_value = new_value;
-
-    // compute 'new_value' and propagate change
-    all_compute(c);
+// propagate for thread pool, one task is one component
+static void propagate_task(void *groups, size_t task_nr) { propagate(&((propagation *)groups)[task_nr]); }
 
-    // only once all values (new_value) have been propagated, we finalize by;
-    //  invoke callbacks and write 'new_value' to 'value'
-    all_invoke(c);
+// order updates by component, see set_cell_values
+static int compare_pending_updates(const void *a, const void *b)
+{
+    unsigned int root_a = ((const pending_update *)a)->root;
+    unsigned int root_b = ((const pending_update *)b)->root;
+    return (root_a > root_b) - (root_a < root_b);
 }
 
-// note: one cell can have multiple callbacks
-callback_id add_callback(cell *cell, void *cb_data, callback cb)
+/*
+ * Components: union-find over all cells (by index), where a set is all cells connected to each other.
+ *  A compute cell joins the component of its parent(s), joining the two components if needed.
+ *  (Released cells stay in the tree, so a component is never split)
+ */
+// find root without modifying anything (components may be read concurrently)
+static unsigned int component_root(const reactor *r, unsigned int i)
 {
-    if (!cell || !cb) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    while (r->components[i] != i) {
+        i = r->components[i];
     }
-    if (cell->reactor->next_cb_id == INT_MAX) {
-        fprintf(stderr, "Sorry! Callbacks full, have already %d\n", cell->reactor->next_cb_id);
-        return 0;
+    return i;
+}
+// find root and make every other cell on the way point to its grandparent (path halving)
+static unsigned int component_find(reactor *r, unsigned int i)
+{
+    while (r->components[i] != i) {
+        r->components[i] = r->components[r->components[i]];
+        i = r->components[i];
+    }
+    return i;
+}
+// join components of both cells (by rank)
+static void component_union(reactor *r, unsigned int a, unsigned int b)
+{
+    unsigned int tmp;
+    a = component_find(r, a);
+    b = component_find(r, b);
+    if (a == b) {
+        return;
+    }
+    if (r->component_ranks[a] < r->component_ranks[b]) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    r->components[b] = a;
+    if (r->component_ranks[a] == r->component_ranks[b]) {
+        r->component_ranks[a]++;
     }
+}
 
-    callback_st *cb_st = calloc(1, sizeof(callback_st));
-    cb_st->data = cb_data;
-    cb_st->func = cb;
-    cb_st->id = cell->reactor->next_cb_id++;
-    cb_st->next_cb_st = NULL;  // we are last in list
+/*
+ * Hash-consing: hash table of compute cells, by function and parents.
+ *  Open addressing with linear probing, at most half full.
+ */
+static inline uint64_t hash_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+static size_t consed_hash(cell *parent1, cell *parent2, compute1 compute1, compute2 compute2)
+{
+    uint64_t hash = hash_mix((uint64_t)(uintptr_t)parent1);
+    hash = hash_mix(hash ^ (uint64_t)(uintptr_t)parent2);
+    hash = hash_mix(hash ^ (compute1 ? (uint64_t)(uintptr_t)compute1 : (uint64_t)(uintptr_t)compute2));
+    return (size_t)hash;
+}
 
-    // first callback on cell, cell point to us directly
-    if (cell->cb_st == NULL) {
-        cell->cb_st = cb_st;
-        // otherwise, previous cb in list should point to us, not null
-    } else {
-        callback_st *tmp = cell->cb_st;
-        while (tmp->next_cb_st) {
-            tmp = tmp->next_cb_st;
+// returns slot with the matching cell, or the empty slot where it should be
+static cell **consed_slot(reactor *r, cell *parent1, cell *parent2, compute1 compute1, compute2 compute2)
+{
+    size_t mask = r->consed_size - 1;
+    size_t i = consed_hash(parent1, parent2, compute1, compute2) & mask;
+    cell *c;
+    while ((c = r->consed_cells[i])) {
+        if (c->parents[0] == parent1 && c->parents[1] == parent2 && c->compute1 == compute1 &&
+            c->compute2 == compute2) {
+            break;
         }
-        tmp->next_cb_st = cb_st;
+        i = (i + 1) & mask;
     }
-    return cb_st->id;
+    return &r->consed_cells[i];
 }
 
-/*
- * Remove a single callback (cb_st) from cell, matching the id.
- *  (cb_st is a linked list of one or multiple cb_st)
- */
-void remove_callback(cell *c, callback_id id)
+static void consed_insert(reactor *r, cell *c)
 {
-    callback_st *cb_st, *cb_st_previous, *matching_cb;
-    if (!c) {
-        fprintf(stderr, "Invalid input given\n");
-        exit(1);
+    if ((r->nr_of_consed + 1) * 2 > r->consed_size) {
+        // grow table
+        cell **old_cells = r->consed_cells;
+        size_t old_size = r->consed_size;
+        r->consed_size = old_size ? old_size * 2 : 64;
+        r->consed_cells = calloc(r->consed_size, sizeof(cell *));
+        if (!r->consed_cells) {
+            exit(1);
+        }
+        for (size_t i = 0; i < old_size; i++) {
+            if (old_cells[i]) {
+                cell *old = old_cells[i];
+                *consed_slot(r, old->parents[0], old->parents[1], old->compute1, old->compute2) = old;
+            }
+        }
+        free(old_cells);
     }
-    if (!c->cb_st) return;
+    cell **slot = consed_slot(r, c->parents[0], c->parents[1], c->compute1, c->compute2);
+    if (!*slot) {
+        *slot = c;
+        r->nr_of_consed++;
+    }
+}
 
-    // check first element in cb_st
-    if (c->cb_st->id == id) {
-        matching_cb = c->cb_st;
-        // put second element in list first (element is be NULL if matching_cb was only element in list)
-        c->cb_st = matching_cb->next_cb_st;
-        free(matching_cb);
+// remove cell, then move back later cells in the same run so they can still be found (no tombstones needed)
+static void consed_remove(reactor *r, cell *c)
+{
+    if (r->consed_size == 0) {
         return;
     }
-
-    // otherwise check rest of list
-    cb_st_previous = c->cb_st;
-    cb_st = c->cb_st->next_cb_st;
-    while (cb_st) {
-        if (cb_st->id == id) {
-            matching_cb = cb_st;
-            // point previous cb_st to the one after matching entry (points to NULL if last)
-            cb_st_previous->next_cb_st = matching_cb->next_cb_st;
-            free(matching_cb);
-            return;
+    size_t mask = r->consed_size - 1;
+    cell **slot = consed_slot(r, c->parents[0], c->parents[1], c->compute1, c->compute2);
+    if (*slot != c) {
+        return;  // not in table
+    }
+    size_t hole = (size_t)(slot - r->consed_cells);
+    for (size_t i = (hole + 1) & mask; r->consed_cells[i]; i = (i + 1) & mask) {
+        cell *moved = r->consed_cells[i];
+        size_t home = consed_hash(moved->parents[0], moved->parents[1], moved->compute1, moved->compute2) & mask;
+        // move if its home slot is not in (hole, i], i.e. it would not be found after the hole
+        if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+            r->consed_cells[hole] = moved;
+            hole = i;
         }
-        cb_st_previous = cb_st;
-        cb_st = cb_st->next_cb_st;
     }
+    r->consed_cells[hole] = NULL;
+    r->nr_of_consed--;
 }
 
-/* --- INTERNAL FUNCTIONS --- */
+// returns the existing equal cell (with one more reference), if any
+static cell *retain_consed(reactor *r, cell *parent1, cell *parent2, compute1 compute1, compute2 compute2)
+{
+    if (r->consed_size == 0) {
+        return NULL;
+    }
+    cell *existing = *consed_slot(r, parent1, parent2, compute1, compute2);
+    if (!existing) {
+        return NULL;
+    }
+    if (existing->refs == UINT_MAX) {
+        fprintf(stderr, "Sorry! Cell has already been created %u times\n", existing->refs);
+        return NULL;
+    }
+    existing->refs++;
+    return existing;
+}
 
 // delete all callbacks on a single cell
 static void destroy_cell_callbacks(cell *c)
@@ -265,49 +1702,292 @@ static void destroy_cell_callbacks(cell *c)
 }
 
 /*
- * Add a child to compute cell c (in c->children), if child is null: allocate and zero initialize that child.
- *  Returns child (same as the given argument 'child' if it wasn't NULL)
+ * Add a child to cell c (in c->children).
  *
  * Each parent have a cell** children, which contains a list to its direct children,
- *  this function (re-)allocates the children memory and points this new area to a new child.
- * Both children and new child (children[nr_of_children-1]) need to be freed.
+ *  when full the list is reallocated with twice the room (unless room was already reserved, see reactor_add_cells).
+ * Both children and new child need to be freed (free_children and free_cell).
  */
-static cell *compute_cell_add_child(cell *c, cell *child)
+static void compute_cell_add_child(reactor *r, cell *c, cell *child)
 {
-    cell **children;
-    unsigned int nr_of_children;
-    size_t new_size;
+    assert(c && child);
+    assert(c->nr_of_children < UINT_MAX);
 
-    assert(c);
-    assert(!(c->children && c->nr_of_children == 0));  // no children but ptr not NULL
+    if (c->nr_of_children == c->children_size) {
+        reserve_children(r, c, c->children_size ? (size_t)c->children_size * 2 : 4);
+    }
+    // write address of new child to the expanded memory
+    c->children[c->nr_of_children++] = child;
+}
 
-    if (c->nr_of_children == UINT_MAX) {
-        fprintf(stderr, "Sorry! Parent is full and has already %d children\n", c->nr_of_children);
-        return NULL;
+// remove child from compute cell c (every time it occurs), frees children when the last is removed
+static void compute_cell_remove_child(cell *c, cell *child)
+{
+    for (unsigned int i = 0; i < c->nr_of_children;) {
+        if (c->children[i] == child) {
+            c->children[i] = c->children[--c->nr_of_children];
+        } else {
+            i++;
+        }
+    }
+    if (c->nr_of_children == 0) {
+        free_children(c);
+    }
+}
+
+// add a cache of (at least) memo_size results to compute cell, rounded up to a power of two
+static void enable_memo(cell *c, unsigned int memo_size)
+{
+    unsigned int nr_of_entries = 1;
+    while (nr_of_entries < memo_size && nr_of_entries < (1U << 20)) {
+        nr_of_entries *= 2;
     }
+    c->memo = calloc(nr_of_entries, sizeof(memo_entry));
+    if (!c->memo) {
+        fprintf(stderr, "Sorry! Could not allocate memo, cell will not be memoized\n");
+        return;
+    }
+    c->memo_mask = nr_of_entries - 1;
+}
 
-    if (!child) {
-        child = calloc(1, sizeof(cell));
+/*
+ * Compute value of compute cell from its parents' values (arg2 is not used for compute1),
+ *  a memoizing cell first checks its cache (direct-mapped, a miss overwrites the entry).
+ * Forks bypass the cache, since the cell is shared with forks which may run at the same time.
+ */
+static int call_compute(reactor *r, cell *c, int arg1, int arg2)
+{
+    if (!c->memo || r != c->reactor) {
+        return c->compute1 ? c->compute1(arg1) : c->compute2(arg1, arg2);
     }
 
-    nr_of_children = c->nr_of_children + 1;
-    new_size = nr_of_children * sizeof(cell *);
+    uint32_t hash = (uint32_t)arg1 * 0x9E3779B1U + (uint32_t)arg2;
+    hash = (hash ^ (hash >> 16)) * 0x85EBCA6BU;
+    memo_entry *entry = &c->memo[(hash ^ (hash >> 13)) & c->memo_mask];
+    if (entry->valid && entry->args[0] == arg1 && entry->args[1] == arg2) {
+        c->memo_hits++;
+        return entry->result;
+    }
+    c->memo_misses++;
+    entry->args[0] = arg1;
+    entry->args[1] = arg2;
+    entry->result = c->compute1 ? c->compute1(arg1) : c->compute2(arg1, arg2);
+    entry->valid = true;
+    return entry->result;
+}
 
-    // reallocate children
-    //  c->children points to a memory area, increase this to hold one more pointer
-    //  or if c->children=NULL this will initialize the memory (to hold one child pointer)
-    children = realloc(c->children, new_size);
-    if (!children) {
-        exit(1);
+/*
+ * Aggregate cells: sum and count keep a running total, min and max a segment tree of the parents' values.
+ *  Each parent's value is kept (seen) so a change can be applied as a difference, in O(1) or O(log n).
+ */
+// index of parent in a->parents, or nr_of_parents if not a parent
+static unsigned int aggregate_slot(const aggregate *a, const cell *parent)
+{
+    size_t mask = a->slots_size - 1;
+    for (size_t k = hash_mix((uint64_t)(uintptr_t)parent) & mask; a->slots[k]; k = (k + 1) & mask) {
+        if (a->parents[a->slots[k] - 1].cell == parent) {
+            return a->slots[k] - 1;
+        }
     }
+    return a->nr_of_parents;
+}
 
-    // save result
-    c->children = children;
-    c->nr_of_children = nr_of_children;
-    // write address of new child to the expanded memory
-    children[nr_of_children - 1] = child;
+// add parent (or count it once more if already a parent)
+static void aggregate_add_parent(aggregate *a, cell *parent)
+{
+    unsigned int slot = aggregate_slot(a, parent);
+    if (slot < a->nr_of_parents) {
+        a->parents[slot].multiplicity++;
+        return;
+    }
+    size_t mask = a->slots_size - 1;
+    size_t k = hash_mix((uint64_t)(uintptr_t)parent) & mask;
+    while (a->slots[k]) {
+        k = (k + 1) & mask;
+    }
+    a->slots[k] = a->nr_of_parents + 1;
+    a->parents[a->nr_of_parents].cell = parent;
+    a->parents[a->nr_of_parents].seen = 0;
+    a->parents[a->nr_of_parents].multiplicity = 1;
+    a->nr_of_parents++;
+}
 
-    return child;
+// set the value of parent in slot
+static void aggregate_set(aggregate *a, unsigned int slot, int value)
+{
+    aggregate_parent *parent = &a->parents[slot];
+    switch (a->kind) {
+        case AGGREGATE_SUM:
+            a->total += ((int64_t)value - parent->seen) * parent->multiplicity;
+            break;
+        case AGGREGATE_COUNT:
+            a->total += ((value != 0) - (parent->seen != 0)) * (int64_t)parent->multiplicity;
+            break;
+        default: {
+            size_t i = a->tree_size + slot;
+            a->tree[i] = value;
+            for (i /= 2; i > 0; i /= 2) {
+                int left = a->tree[2 * i], right = a->tree[2 * i + 1];
+                a->tree[i] = (a->kind == AGGREGATE_MIN) == (left < right) ? left : right;
+            }
+            break;
+        }
+    }
+    parent->seen = value;
+}
+
+static int aggregate_value(const aggregate *a)
+{
+    switch (a->kind) {
+        case AGGREGATE_SUM:
+        case AGGREGATE_COUNT:
+            return a->total > INT_MAX ? INT_MAX : a->total < INT_MIN ? INT_MIN : (int)a->total;
+        default:
+            return a->tree[1];
+    }
+}
+
+// value of aggregate cell c after parent changed (during propagation)
+static int aggregate_update(reactor *r, cell *c, cell *parent)
+{
+    aggregate *a = c->aggregate;
+    unsigned int slot = aggregate_slot(a, parent);
+    assert(slot < a->nr_of_parents);
+    int value = get_new_value(r, parent);
+    if (a->parents[slot].seen != value) {
+        if (r->speculating) {
+            save_old_slot(r, c, slot);
+        }
+        aggregate_set(a, slot, value);
+    }
+    return aggregate_value(a);
+}
+
+// compute aggregate from all (refreshed) parents, or their new values during propagation,
+//  and start over with that as state if save_state
+static int aggregate_recompute(reactor *r, cell *c, bool save_state, bool new_values)
+{
+    aggregate *a = c->aggregate;
+    if (save_state) {
+        a->total = 0;
+        for (size_t i = 1; i < 2 * a->tree_size; i++) {
+            a->tree[i] = a->kind == AGGREGATE_MIN ? INT_MAX : INT_MIN;  // (also the leaves of no parent)
+        }
+        for (unsigned int k = 0; k < a->nr_of_parents; k++) {
+            cell *parent = a->parents[k].cell;
+            a->parents[k].seen = 0;
+            aggregate_set(a, k, new_values ? get_new_value(r, parent) : refresh_value(r, parent));
+        }
+        return aggregate_value(a);
+    }
+
+    int64_t total = 0;
+    int extreme = a->kind == AGGREGATE_MIN ? INT_MAX : INT_MIN;
+    for (unsigned int k = 0; k < a->nr_of_parents; k++) {
+        cell *parent = a->parents[k].cell;
+        int value = new_values ? get_new_value(r, parent) : refresh_value(r, parent);
+        if (a->kind == AGGREGATE_SUM) {
+            total += (int64_t)value * a->parents[k].multiplicity;
+        } else if (a->kind == AGGREGATE_COUNT) {
+            total += value != 0 ? a->parents[k].multiplicity : 0;
+        } else if ((a->kind == AGGREGATE_MIN) == (value < extreme)) {
+            extreme = value;
+        }
+    }
+    if (a->kind == AGGREGATE_MIN || a->kind == AGGREGATE_MAX) {
+        return extreme;
+    }
+    return total > INT_MAX ? INT_MAX : total < INT_MIN ? INT_MIN : (int)total;
+}
+
+static void free_aggregate(aggregate *a)
+{
+    if (!a) {
+        return;
+    }
+    free(a->tree);
+    free(a->slots);
+    free(a->parents);
+    free(a);
+}
+
+static inline bool is_compute_cell(const cell *c) { return c->compute1 || c->compute2 || c->aggregate; }
+static inline unsigned int nr_of_parents(const cell *c)
+{
+    if (c->aggregate) {
+        return c->aggregate->nr_of_parents;
+    }
+    return c->parents[1] ? 2 : c->parents[0] ? 1 : 0;
+}
+static inline cell *get_parent(const cell *c, unsigned int k)
+{
+    return c->aggregate ? c->aggregate->parents[k].cell : c->parents[k];
+}
+
+/*
+ * Liveness: only live cells are recomputed during propagation, the value of a dead cell is stale.
+ *  A cell is live if it has callbacks, pins, or live children, so the parents of a live cell are live too.
+ */
+// update live flag after callbacks, pins or live children of c changed, then the same for its parents
+static void update_liveness(cell *c)
+{
+    bool live = c->cb_st || c->pins > 0 || c->nr_of_live_children > 0;
+    if (live == c->live) {
+        return;
+    }
+    if (live) {
+        refresh_value(c->reactor, c);  // from now on its value is kept up to date
+    }
+    c->live = live;
+    for (unsigned int k = 0; k < nr_of_parents(c); k++) {
+        cell *parent = get_parent(c, k);
+        if (live) {
+            parent->nr_of_live_children++;
+        } else {
+            parent->nr_of_live_children--;
+        }
+        update_liveness(parent);
+    }
+}
+
+// value of c as seen by r, a dead compute cell is first recomputed from its parents (unless done since last update)
+static int refresh_value(reactor *r, cell *c)
+{
+    if (c->live || !is_compute_cell(c) || r->base->nr_of_unfiltered_subscriptions > 0) {
+        return get_value(r, c);
+    }
+    if (r == c->reactor && c->refresh_nr == r->update_nr) {
+        return c->value;
+    }
+    return recompute(r, c);
+}
+
+/*
+ * Compute value of c from its (refreshed) parents, the value is saved in c unless forks may read it at the same time
+ *  (then it is computed again on every read). During speculation, the value is saved in the undo log as well.
+ */
+static int recompute(reactor *r, cell *c)
+{
+    bool save = r == c->reactor && atomic_load(&r->nr_of_forks) == 0;
+    int value;
+    if (c->aggregate) {
+        value = aggregate_recompute(r, c, save, false);
+    } else {
+        int arg1 = refresh_value(r, c->parents[0]);
+        int arg2 = c->parents[1] ? refresh_value(r, c->parents[1]) : 0;
+        value = call_compute(r, c, arg1, arg2);
+    }
+    if (!save) {
+        return value;
+    }
+    c->value = value;
+    c->new_value = value;
+    c->refresh_nr = r->update_nr;
+    if (r->speculating && c->speculation_nr != r->speculation_nr) {
+        save_old_value(r, c);
+        r->undo_log[r->undo_log_length - 1].refreshed = true;
+    }
+    return value;
 }
 
 /* Functions to perform on a cell and ALL its children;
@@ -319,10 +1999,16 @@ static void all_delete(cell *c)
 {
     // for each branch of the tree
     //  iterate all the way down and then free each cell upwards
-    iterate_over_all_children(c, FROM_LAST_TO_FIRST_CELL, delete_cell);
+    iterate_over_all_children(NULL, c, FROM_LAST_TO_FIRST_CELL, delete_cell);
+}
+static void all_compute(propagation *p, cell *c)
+{
+    iterate_over_all_children(p, c, FROM_FIRST_TO_LAST_CELL, compute_value);
+}
+static void all_invoke(propagation *p, cell *c)
+{
+    iterate_over_all_children(p, c, FROM_FIRST_TO_LAST_CELL, invoke_callbacks);
 }
-static void all_compute(cell *c) { iterate_over_all_children(c, FROM_FIRST_TO_LAST_CELL, compute_value); }
-static void all_invoke(cell *c) { iterate_over_all_children(c, FROM_FIRST_TO_LAST_CELL, invoke_callbacks); }
 
 /*
  * Perform supplied action on a cell, then go deeper (first a parent, then all its children, and then on the children's
@@ -338,7 +2024,8 @@ static void all_invoke(cell *c) { iterate_over_all_children(c, FROM_FIRST_TO_LAS
  *
  * Comment: recursion in C might blow the stack if we go too deep?
  */
-static void iterate_over_all_children(cell *c, enum iterate_order order, bool (*func)(cell *))
+static void iterate_over_all_children(propagation *p, cell *c, enum iterate_order order,
+                                      bool (*func)(propagation *, cell *))
 {
     bool is_finished = false;
     assert(func);
@@ -347,7 +2034,7 @@ static void iterate_over_all_children(cell *c, enum iterate_order order, bool (*
     }
 
     if (order == FROM_FIRST_TO_LAST_CELL) {
-        is_finished = func(c);
+        is_finished = func(p, c);
         if (is_finished) {
             // stop iterating if we are finised. (this is just an optimisation and not necessary,
             // since the function should not do anything if called when it has nothing to do)
@@ -357,95 +2044,110 @@ static void iterate_over_all_children(cell *c, enum iterate_order order, bool (*
 
     // go deeper
     for (unsigned int i = 0; c->children != NULL && i < c->nr_of_children; i++) {
-        iterate_over_all_children(c->children[i], order, func);
+        if (p) {
+            p->from = c;
+        }
+        iterate_over_all_children(p, c->children[i], order, func);
     }
 
     if (order == FROM_LAST_TO_FIRST_CELL) {
-        func(c);  // return value is unnecessary (we can't and don't want to stop early)
+        func(p, c);  // return value is unnecessary (we can't and don't want to stop early)
     }
 }
 
 /* functions used in iterate_over_all_children, returns true when iteration should end */
 
-// returns true if calling the compute function did not change value
-static bool compute_value(cell *c)
+// returns true if calling the compute function did not change value, or if the cell is dead (not computed)
+//  (compared to the last computed value, not the stable one: a cell may be reached from several changed parents,
+//   then its children must be computed again if it changed back to the stable value)
+static bool compute_value(propagation *p, cell *c)
 {
+    reactor *r = p->reactor;
+    if (!c->live && r->base->nr_of_unfiltered_subscriptions == 0 && is_compute_cell(c)) {
+        // no one observes this cell nor its children, skip them (see refresh_value)
+        return true;
+    }
+    int previous_value = get_new_value(r, c);
+    int new_value;
+
     if (c->compute1) {
-        c->new_value = c->compute1(c->parents[0]->new_value);
+        new_value = call_compute(r, c, get_new_value(r, c->parents[0]), 0);
     } else if (c->compute2) {
-        c->new_value = c->compute2(c->parents[0]->new_value, c->parents[1]->new_value);
+        new_value = call_compute(r, c, get_new_value(r, c->parents[0]), get_new_value(r, c->parents[1]));
+    } else if (c->aggregate) {
+        // (forks share the aggregate's state, they compute it from scratch)
+        new_value = r == c->reactor ? aggregate_update(r, c, p->from) : aggregate_recompute(r, c, false, true);
     } else {
         // we are a top-level cell (i.e. input cell), go deeper
         return false;
     }
-    if (c->value == c->new_value) {
+    if (previous_value == new_value) {
         // new value is the same, nothing to propagate, we are done
         return true;
     }
+    set_new_value(r, c, new_value);
     return false;
 }
 // returns true if value hasn't changed since last time (and therefore callbacks are not invoked)
-static bool invoke_callbacks(cell *c)
+//  (when speculating, callbacks are not invoked, instead the old value is saved. Forks have no callbacks)
+static bool invoke_callbacks(propagation *p, cell *c)
 {
-    if (c->value == c->new_value) {
+    reactor *r = p->reactor;
+    int new_value = get_new_value(r, c);
+    if (get_value(r, c) == new_value) {
         // value not changed, don't invoke callbacks, we are done
         return true;
     }
-    // invoke all callbacks on the cell
-    if (c->cb_st) {
-        callback_st *cb_st = c->cb_st;
-        cb_st->func(cb_st->data, c->new_value);
-
-        cb_st = cb_st->next_cb_st;
-        while (cb_st) {
-            cb_st->func(cb_st->data, c->new_value);
-            cb_st = cb_st->next_cb_st;
-        }
+    if (r->speculating) {
+        save_old_value(r, c);
+    } else if (c->cb_st && !r->fork_parent) {
+        // invoke all callbacks on the cell
+        run_callbacks(c->cb_st, new_value);
+    }
+    if (p->changes && !r->speculating) {
+        add_change(p->changes, c, get_value(r, c), new_value);
     }
 
     // set 'value' to signify that all callbacks have been called
     //  (calling this function again will thus not trigger callbacks)
-    c->value = c->new_value;
+    set_value(r, c, new_value);
     return false;
 }
 
 // delete everything on a single cell, and update its parent accordingly (modify cell->parent->children)
 // returns true if the cell has no parents, indicating that the whole tree should now be empty
-static bool delete_cell(cell *c)
+static bool delete_cell(propagation *p, cell *c)
 {
     bool parent_has_no_children;
-    unsigned int nr_parents = 0;  // here, c may have 0, 1, or 2 parents
-    if (c->parents[0] && c->parents[0]->children) {
-        nr_parents++;
-    }
-    if (c->parents[1] && c->parents[1]->children) {
-        nr_parents++;
-        assert(nr_parents == 2);
-    }
+    unsigned int nr_parents = nr_of_parents(c);  // here, c may have 0, 1, 2 or (aggregate) more parents
+    (void)p;
 
     // delete my parent(s) references to me, then if they have no children left free that memory (cell **children)
     for (unsigned int k = 0; k < nr_parents; k++) {
+        cell *parent = get_parent(c, k);
+        if (!parent->children) {
+            continue;  // both parents are the same cell, its children were already freed
+        }
         parent_has_no_children = true;
 
-        for (unsigned int i = 0; i < c->parents[k]->nr_of_children; i++) {
-            if (c == c->parents[k]->children[i]) {
+        for (unsigned int i = 0; i < parent->nr_of_children; i++) {
+            if (c == parent->children[i]) {
                 // delete reference to me
-                c->parents[k]->children[i] = NULL;
+                parent->children[i] = NULL;
             }
-            if (c->parents[k]->children[i] != NULL) {
+            if (parent->children[i] != NULL) {
                 parent_has_no_children = false;
             }
         }
 
         if (parent_has_no_children) {
             // I was last child, free children
-            free(c->parents[k]->children);
-            c->parents[k]->children = NULL;
+            free_children(parent);
         }
     }
     // delete my callbacks and then finally delete myself
     destroy_cell_callbacks(c);
-    free(c);
+    free_cell(c);
 
     if (nr_parents == 0) {
         return true;
@@ -3,7 +3,11 @@
  */
 #ifndef REACT_H
 #define REACT_H
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 struct cell;
 struct reactor;
@@ -31,6 +35,122 @@ void remove_callback(struct cell *, callback_id);
 
 /* My additions */
 struct callback_st;
+struct thread_pool;
+struct undo_entry;
+struct value_chunk;
+struct subscription;
+struct memo_entry;
+struct slab;
+struct aggregate;
+
+// Set many input cells at once, callbacks are invoked (at most) once per changed cell.
+//  Updates to unconnected parts of the graph (components) are propagated concurrently,
+//  as such callbacks on different components may run at the same time on different threads.
+void set_cell_values(struct cell **, const int *new_values, size_t nr_of_values);
+// Number of threads used by set_cell_values, default is 1 (i.e. everything is done by the calling thread)
+void reactor_set_threads(struct reactor *, unsigned int nr_of_threads);
+
+// Speculative updates: cells are set and read as usual but no callbacks are invoked, instead the old values are saved.
+//  Rollback gives every changed cell its old value back (without computing anything),
+//  commit keeps the new values and invokes callbacks once for each cell which ended up with a different value.
+//  While speculating no compute cells may be created (also not with reactor_add_cells / reactor_instantiate) or
+//  released, as their values would not be rolled back.
+void reactor_begin_speculation(struct reactor *);
+void reactor_rollback(struct reactor *);
+void reactor_commit(struct reactor *);
+
+// Fork: a child reactor sharing cells (and their values) with its parent, use destroy_reactor when done.
+//  Values are only copied when changed in the fork, a chunk (REACTOR_CHUNK_SIZE cells) at a time.
+//  Forks do not invoke callbacks, may not create cells, and do not support speculation.
+//  A reactor with forks is frozen, it may not be modified until all its forks are destroyed,
+//  but different forks (of the same parent) may be used at the same time from different threads.
+struct reactor *reactor_fork(struct reactor *);
+// get and set value of a cell as seen by the given reactor (i.e. also works for forks)
+int reactor_get_cell_value(struct reactor *, struct cell *);
+void reactor_set_cell_value(struct reactor *, struct cell *, int new_value);
+
+// Record all values given to input cells (set_cell_value, set_cell_values, reactor_set_cell_value) to a binary log,
+//  which can be replayed with react_replay. Returns 0 on success.
+//  Values given while speculating are recorded when the speculation is committed (and not at all on rollback),
+//  when recording is stopped before then they are not recorded.
+int reactor_start_recording(struct reactor *, const char *file_name);
+void reactor_stop_recording(struct reactor *);
+
+// Change feed: instead of one callback per cell, get all changes of one update (set_cell_value, set_cell_values,
+//  or reactor_commit) in one call. Filter is a list of cells to include, or NULL to get changes of all cells.
+//  The feed is called after all callbacks, and must not change the reactor (nor subscribe or unsubscribe).
+typedef struct cell_change {
+    struct cell *cell;
+    int old_value;
+    int new_value;
+} cell_change;
+typedef void (*change_feed)(void *, const cell_change *changes, size_t nr_of_changes);
+typedef int subscription_id;
+
+subscription_id reactor_subscribe(struct reactor *, struct cell **filter, size_t nr_of_cells, void *, change_feed);
+void reactor_unsubscribe(struct reactor *, subscription_id);
+
+// Hash-consing: when enabled, creating a compute cell with the same function and parents as an existing compute cell
+//  returns the existing cell instead (and increases its reference count).
+void reactor_enable_hash_consing(struct reactor *);
+// Release a compute cell, it is deleted when released as many times as it was created (and has no children left)
+void release_cell(struct cell *);
+
+// Memoizing compute cells, for expensive functions which are pure (the result only depends on the arguments):
+//  the cell caches memo_size results (direct-mapped by the arguments), the function is only called on a miss.
+//  If hash-consing gives an existing cell, caching is enabled on that cell (unless it already has a cache).
+struct cell *create_memo_compute1_cell(struct reactor *, struct cell *, compute1, unsigned int memo_size);
+struct cell *create_memo_compute2_cell(struct reactor *, struct cell *, struct cell *, compute2,
+                                       unsigned int memo_size);
+void get_cell_memo_stats(struct cell *, unsigned long *hits, unsigned long *misses);
+
+// Liveness: a cell is live if it has callbacks, is pinned, or has a live child. Only live cells are recomputed when
+//  inputs change, the value of another (dead) cell is recomputed from its parents when read (get_cell_value).
+//  Pin a cell which is read often but has no callbacks. Cells in the filter of a subscription are pinned,
+//  while there is a subscription without filter all cells are recomputed (they are all observed).
+//  Changing liveness (pins and callbacks) is not allowed while the reactor is frozen (has forks).
+void pin_cell(struct cell *);
+void unpin_cell(struct cell *);
+
+// Aggregate cells: one compute cell over many parents, when a parent changes sum and count are updated in O(1)
+//  and min and max in O(log n). A parent given more than once counts as many times for sum and count.
+//  The sum saturates at INT_MIN / INT_MAX, count is the number of parents which are not zero.
+//  (In forks, and for cells which were dead, the aggregate is computed from all parents instead)
+enum aggregate_kind { AGGREGATE_SUM, AGGREGATE_COUNT, AGGREGATE_MIN, AGGREGATE_MAX };
+struct cell *create_aggregate_cell(struct reactor *, enum aggregate_kind, struct cell **parents, size_t nr_of_parents);
+
+// Bulk construction: a list of cells to create, in order. The parents of a compute cell are either existing cells
+//  (parent_cells) or cells created earlier in the same list (parent_specs, the index in the list).
+enum cell_spec_kind { CELL_SPEC_INPUT, CELL_SPEC_COMPUTE1, CELL_SPEC_COMPUTE2 };
+typedef struct cell_spec {
+    enum cell_spec_kind kind;
+    int value;  // initial value (input)
+    compute1 compute1;
+    compute2 compute2;
+    struct cell *parent_cells[2];  // existing parent, or NULL to use parent_specs
+    size_t parent_specs[2];        // index of parent in list, lower than the index of this cell
+} cell_spec;
+
+// Reserve memory for nr_of_cells more cells with nr_of_edges more children in total,
+//  so they are created without any reallocation. Returns 0 on success.
+int reactor_reserve(struct reactor *, size_t nr_of_cells, size_t nr_of_edges);
+// Create all cells in specs, out gets the created cells (in the same order). Returns 0 on success
+//  (on failure, see reactor_instantiate).
+int reactor_add_cells(struct reactor *, const cell_spec *specs, size_t nr_of_specs, struct cell **out);
+// Create nr_of_copies of the cells in specs (a template), where parent_specs refer to cells in the same copy
+//  while parent_cells are shared by all copies. out gets nr_of_specs cells per copy. Returns 0 on success.
+//  On failure to create a cell the cells created before it are kept, out has them up to the cell which failed (NULL).
+int reactor_instantiate(struct reactor *, const cell_spec *specs, size_t nr_of_specs, size_t nr_of_copies,
+                        struct cell **out);
+
+// Log format: REACTOR_LOG_MAGIC followed by records (native byte order),
+//  where input_index is the input cell's number in order of creation (0 is the first input cell)
+#define REACTOR_LOG_MAGIC "REACTLG1"
+#define REACTOR_LOG_MAGIC_SIZE 8
+typedef struct reactor_log_record {
+    uint32_t input_index;
+    int32_t value;
+} reactor_log_record;
 
 typedef struct callback_st {
     callback func;
@@ -39,10 +159,68 @@ typedef struct callback_st {
     struct callback_st *next_cb_st;
 } callback_st;
 
+#define REACTOR_CHUNK_BITS 6
+#define REACTOR_CHUNK_SIZE (1U << REACTOR_CHUNK_BITS)
+
+typedef struct change_list {
+    cell_change *changes;
+    size_t length;
+    size_t size;
+} change_list;
+
 typedef struct reactor {
     struct cell *first_parent;
     struct cell *last_parent;
     callback_id next_cb_id;
+    unsigned int nr_of_threads;
+    struct thread_pool *pool;  // started on first use by set_cell_values
+
+    /* speculation, old values of all cells changed since reactor_begin_speculation */
+    bool speculating;
+    unsigned long speculation_nr;  // increased for each speculation
+    struct undo_entry *undo_log;
+    size_t undo_log_length;
+    size_t undo_log_size;
+
+    /* all cells in order of creation, cell->index is the position in this list (NULL if cell is released) */
+    struct cell **cells;
+    unsigned int nr_of_cells;
+    unsigned int cells_size;
+
+    /* union-find of cells connected to each other (by cell index), an input cell starts as its own component
+     * and a compute cell joins the components of its parents */
+    unsigned int *components;  // points towards the component root, the root points to itself
+    unsigned char *component_ranks;
+
+    /* hash-consing, see reactor_enable_hash_consing */
+    bool hash_consing;
+    struct cell **consed_cells;  // hash table (open addressing) of compute cells by function and parents
+    size_t consed_size;
+    size_t nr_of_consed;
+
+    /* forks, see reactor_fork */
+    atomic_uint nr_of_forks;       // forks of this reactor which are still alive (if not zero we are frozen)
+    struct reactor *fork_parent;   // reactor we were forked from, NULL if not a fork
+    struct reactor *base;          // the (non fork) reactor owning all cells
+    struct value_chunk **chunks;   // values changed in the fork, chunk=NULL if the values in base are used
+    unsigned int nr_of_chunks;
+
+    unsigned int nr_of_inputs;
+    FILE *recording;  // log of updates to input cells, see reactor_start_recording
+    struct reactor_log_record *speculative_records;  // updates while speculating, written on commit
+    size_t nr_of_speculative_records;
+    size_t speculative_records_size;
+
+    /* change feed, changes are collected during propagation when there are subscriptions */
+    struct subscription *subscriptions;
+    subscription_id next_subscription_id;
+    change_list changes;
+    change_list filtered_changes;  // buffer for subscriptions with filter
+    unsigned int nr_of_unfiltered_subscriptions;  // if not zero, all cells are live
+
+    unsigned long update_nr;  // increased for each update of input cells, see cell->refresh_nr
+
+    struct slab *slabs;  // memory reserved for cells and children, see reactor_reserve
 } reactor;
 
 // cell can be either:
@@ -51,19 +229,41 @@ typedef struct reactor {
 typedef struct cell {
     /* shared fields */
     struct reactor *reactor;
+    unsigned int index;  // position in reactor's list of cells
     struct cell **children;
     unsigned int nr_of_children;
+    unsigned int children_size;  // room for this many children (then children is reallocated)
+    bool children_in_slab;       // children is part of a slab (so not freed on its own)
+    bool in_slab;                // cell is part of a slab (so not freed on its own)
     struct callback_st *cb_st;  // one cell may hold multiple callbacks
     int value;  //(old value is temporarily cached as to not invoke callback multiple times for one change)
     int new_value;
 
     /* input cell fields */
     struct cell *next_parent;  // next top-level parent (so we can free)
+    unsigned int input_index;  // number of input cells created before this one
+
+    unsigned long speculation_nr;  // the last speculation where the old value was saved in reactor's undo_log
 
     /* compute cell fields */
     struct cell *parents[2];
     compute1 compute1;
     compute2 compute2;
+    unsigned int refs;  // number of times the cell was created (hash-consing), see release_cell
+
+    /* memoizing compute cell fields */
+    struct memo_entry *memo;  // cache of results, NULL if not memoizing
+    unsigned int memo_mask;   // nr of entries - 1 (power of two)
+    unsigned long memo_hits;
+    unsigned long memo_misses;
+
+    /* liveness, see pin_cell */
+    bool live;
+    unsigned int pins;
+    unsigned int nr_of_live_children;  // (a child with the same cell as both parents counts twice)
+    unsigned long refresh_nr;          // reactor's update_nr when a dead cell's value was last computed
+
+    struct aggregate *aggregate;  // aggregate cell (instead of compute1 / compute2), see create_aggregate_cell
 } cell;
 
 #endif
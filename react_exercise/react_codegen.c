@@ -0,0 +1,204 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "react_graph.h"
+
+/*
+ * Generate C code for a graph description whose shape never changes, instead of building it in a reactor.
+ *
+ *  react_codegen [-p prefix] <graph> <output.c> <output.h>
+ *
+ * For every input cell there is one update function, which recomputes the cells depending on that input
+ *  (in order of the graph description, so each cell is computed once and after its parents) without any traversal:
+ *
+ *      void <prefix>init(void);              set all cells to their initial value, call this first
+ *      void <prefix>set_<input>(int value);
+ *      int <prefix>get_<cell>(void);
+ *
+ * Built-in operations are inlined, functions (@function) are called directly and must be defined elsewhere.
+ * There are no callbacks, read the cells of interest after each set.
+ */
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void write_header(FILE *out, const graph *g, const char *prefix, const char *graph_name,
+                         const char *header_name)
+{
+    char guard[256];
+    size_t length = 0;
+    for (const char *c = base_name(header_name); *c && length + 1 < sizeof(guard); c++) {
+        guard[length++] = isalnum((unsigned char)*c) ? (char)toupper((unsigned char)*c) : '_';
+    }
+    guard[length] = '\0';
+
+    fprintf(out, "// Generated by react_codegen from %s, do not edit\n", base_name(graph_name));
+    fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf(out, "void %sinit(void);\n\n", prefix);
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        if (g->nodes[i].kind == GRAPH_INPUT) {
+            fprintf(out, "void %sset_%s(int value);\n", prefix, g->nodes[i].name);
+        }
+    }
+    fprintf(out, "\n");
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        fprintf(out, "int %sget_%s(void);\n", prefix, g->nodes[i].name);
+    }
+    fprintf(out, "\n#endif\n");
+}
+
+// declare each function and built-in operation once, in order of first use
+static void write_functions(FILE *out, const graph *g)
+{
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        const graph_node *node = &g->nodes[i];
+        bool seen = false;
+        if (node->kind == GRAPH_INPUT) {
+            continue;
+        }
+        for (unsigned int k = 0; k < i && !seen; k++) {
+            const graph_node *other = &g->nodes[k];
+            seen = other->kind == node->kind && other->op == node->op &&
+                   (node->op || strcmp(other->function, node->function) == 0);
+        }
+        if (seen) {
+            continue;
+        }
+        const char *parameters = node->kind == GRAPH_COMPUTE1 ? "int a" : "int a, int b";
+        if (node->op) {
+            fprintf(out, "static inline int op_%s(%s) { return %s; }\n", node->op->name, parameters,
+                    node->op->expression);
+        } else {
+            fprintf(out, "int %s(%s);\n", node->function, node->kind == GRAPH_COMPUTE1 ? "int" : "int, int");
+        }
+    }
+}
+
+static void write_compute(FILE *out, const graph *g, const graph_node *node)
+{
+    if (node->op) {
+        fprintf(out, "    cell_%s = op_%s(cell_%s", node->name, node->op->name, g->nodes[node->parents[0]].name);
+    } else {
+        fprintf(out, "    cell_%s = %s(cell_%s", node->name, node->function, g->nodes[node->parents[0]].name);
+    }
+    if (node->kind == GRAPH_COMPUTE2) {
+        fprintf(out, ", cell_%s", g->nodes[node->parents[1]].name);
+    }
+    fprintf(out, ");\n");
+}
+
+// returns 0 on success
+static int write_source(FILE *out, const graph *g, const char *prefix, const char *graph_name,
+                        const char *header_name)
+{
+    bool *affected = malloc(g->nr_of_nodes * sizeof(bool));
+    if (!affected) {
+        return 1;
+    }
+
+    fprintf(out, "// Generated by react_codegen from %s, do not edit\n", base_name(graph_name));
+    fprintf(out, "#include \"%s\"\n\n", base_name(header_name));
+    write_functions(out, g);
+    fprintf(out, "\n");
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        fprintf(out, "static int cell_%s;\n", g->nodes[i].name);
+    }
+
+    fprintf(out, "\nvoid %sinit(void)\n{\n", prefix);
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        const graph_node *node = &g->nodes[i];
+        if (node->kind == GRAPH_INPUT) {
+            fprintf(out, "    cell_%s = %d;\n", node->name, node->value);
+        } else {
+            write_compute(out, g, node);
+        }
+    }
+    fprintf(out, "}\n");
+
+    // straight-line update of the cells that depend on each input (parents come before their children)
+    for (unsigned int input = 0; input < g->nr_of_nodes; input++) {
+        if (g->nodes[input].kind != GRAPH_INPUT) {
+            continue;
+        }
+        fprintf(out, "\nvoid %sset_%s(int value)\n{\n", prefix, g->nodes[input].name);
+        fprintf(out, "    if (cell_%s == value) {\n        return;\n    }\n", g->nodes[input].name);
+        fprintf(out, "    cell_%s = value;\n", g->nodes[input].name);
+        for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+            const graph_node *node = &g->nodes[i];
+            affected[i] = i == input || (node->kind != GRAPH_INPUT && affected[node->parents[0]]) ||
+                          (node->kind == GRAPH_COMPUTE2 && affected[node->parents[1]]);
+            if (i != input && affected[i]) {
+                write_compute(out, g, node);
+            }
+        }
+        fprintf(out, "}\n");
+    }
+
+    fprintf(out, "\n");
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        fprintf(out, "int %sget_%s(void) { return cell_%s; }\n", prefix, g->nodes[i].name, g->nodes[i].name);
+    }
+    free(affected);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: react_codegen [-p prefix] <graph> <output.c> <output.h>\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int rv = 1;
+    const char *prefix = "";
+    int arg = 1;
+    graph g;
+    FILE *source = NULL, *header = NULL;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-p") == 0) {
+        prefix = argv[arg + 1];
+        for (size_t i = 0; prefix[i]; i++) {
+            if (!isalnum((unsigned char)prefix[i]) && prefix[i] != '_') {
+                usage();
+            }
+        }
+        arg += 2;
+    }
+    if (arg + 3 != argc) {
+        usage();
+    }
+
+    if (read_graph(argv[arg], &g) != 0) {
+        fprintf(stderr, "Could not read graph %s\n", argv[arg]);
+        return 1;
+    }
+    source = fopen(argv[arg + 1], "w");
+    header = fopen(argv[arg + 2], "w");
+    if (!source || !header) {
+        fprintf(stderr, "Could not open output files\n");
+        goto cleanup;
+    }
+    write_header(header, &g, prefix, argv[arg], argv[arg + 2]);
+    if (write_source(source, &g, prefix, argv[arg], argv[arg + 2]) != 0 || ferror(source) || ferror(header)) {
+        fprintf(stderr, "Could not write output files\n");
+        goto cleanup;
+    }
+    rv = 0;
+
+cleanup:
+    if (source && fclose(source) != 0) {
+        rv = 1;
+    }
+    if (header && fclose(header) != 0) {
+        rv = 1;
+    }
+    free_graph(&g);
+    return rv;
+}
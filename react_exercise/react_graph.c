@@ -0,0 +1,315 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "react_graph.h"
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * built-in operations, arithmetic wraps around (it is done unsigned) instead of overflowing.
+ *  Each is a C expression of a (and b), so the same expression can be used by react_codegen.
+ */
+#define GRAPH_OPS1(X)                                   \
+    X(identity, a)                                      \
+    X(negate, (int)(0U - (unsigned int)a))              \
+    X(increment, (int)((unsigned int)a + 1U))           \
+    X(decrement, (int)((unsigned int)a - 1U))           \
+    X(double, (int)((unsigned int)a * 2U))              \
+    X(half, a / 2)                                      \
+    X(square, (int)((unsigned int)a * (unsigned int)a)) \
+    X(not, !a)
+#define GRAPH_OPS2(X)                                   \
+    X(add, (int)((unsigned int)a + (unsigned int)b))    \
+    X(sub, (int)((unsigned int)a - (unsigned int)b))    \
+    X(mul, (int)((unsigned int)a * (unsigned int)b))    \
+    X(min, a < b ? a : b)                               \
+    X(max, a > b ? a : b)                               \
+    X(and, a & b)                                       \
+    X(or, a | b)                                        \
+    X(xor, a ^ b)
+
+#define DEFINE_OP1(name, expression) \
+    static int op_##name(int a) { return expression; }
+#define DEFINE_OP2(name, expression) \
+    static int op_##name(int a, int b) { return expression; }
+GRAPH_OPS1(DEFINE_OP1)
+GRAPH_OPS2(DEFINE_OP2)
+
+#define OP1_ENTRY(name, expression) {#name, op_##name, NULL, #expression},
+#define OP2_ENTRY(name, expression) {#name, NULL, op_##name, #expression},
+static const graph_op graph_ops[] = {GRAPH_OPS1(OP1_ENTRY) GRAPH_OPS2(OP2_ENTRY)};
+
+static const graph_op *find_op(const char *name)
+{
+    for (size_t i = 0; i < sizeof(graph_ops) / sizeof(graph_ops[0]); i++) {
+        if (strcmp(graph_ops[i].name, name) == 0) {
+            return &graph_ops[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_identifier(const char *name)
+{
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_') {
+        return false;
+    }
+    for (size_t i = 1; name[i]; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// op is either a built-in operation or @function, returns 0 on success
+static int parse_op(graph_node *node, const char *op)
+{
+    if (op[0] == '@') {
+        if (strlen(op + 1) >= GRAPH_NAME_MAX || !is_identifier(op + 1)) {
+            return 1;
+        }
+        strcpy(node->function, op + 1);
+        return 0;
+    }
+    node->op = find_op(op);
+    return node->op ? 0 : 1;
+}
+
+/*
+ * Names of nodes (or their functions) -> node index, open addressing hash table
+ *  (so parents can be looked up quickly also in large graphs)
+ */
+typedef struct name_table {
+    unsigned int *slots;  // node index + 1, 0 is empty
+    size_t size;          // power of two
+    size_t key;           // offset of the name in graph_node, of name or function
+} name_table;
+
+static size_t hash_name(const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (size_t i = 0; name[i]; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+static const char *node_key(const name_table *table, const graph *g, unsigned int slot)
+{
+    return (const char *)&g->nodes[slot - 1] + table->key;
+}
+
+// returns slot where name is, or the empty slot where it should be inserted
+static unsigned int *name_slot(const name_table *table, const graph *g, const char *name)
+{
+    size_t i = hash_name(name) & (table->size - 1);
+    while (table->slots[i] && strcmp(node_key(table, g, table->slots[i]), name) != 0) {
+        i = (i + 1) & (table->size - 1);
+    }
+    return &table->slots[i];
+}
+
+// make sure table has room for nr_of_names (at most half full), returns 0 on success
+static int name_table_reserve(name_table *table, const graph *g, size_t nr_of_names)
+{
+    if (nr_of_names * 2 <= table->size) {
+        return 0;
+    }
+    name_table bigger = {.size = table->size ? table->size * 2 : 64, .key = table->key};
+    while (nr_of_names * 2 > bigger.size) {
+        bigger.size *= 2;
+    }
+    bigger.slots = calloc(bigger.size, sizeof(unsigned int));
+    if (!bigger.slots) {
+        return 1;
+    }
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->slots[i]) {
+            *name_slot(&bigger, g, node_key(table, g, table->slots[i])) = table->slots[i];
+        }
+    }
+    free(table->slots);
+    *table = bigger;
+    return 0;
+}
+
+// find parent by name, returns 0 on success
+static int find_parent(const name_table *table, const graph *g, const char *name, unsigned int *out)
+{
+    unsigned int slot = *name_slot(table, g, name);
+    if (!slot) {
+        return 1;
+    }
+    *out = slot - 1;
+    return 0;
+}
+
+// a function must be called with the same number of arguments by all nodes (as it is declared once),
+//  returns the first node calling the function of node, which calls it with another number, or NULL
+static const graph_node *other_arity(name_table *functions, const graph *g, unsigned int node_index)
+{
+    const graph_node *node = &g->nodes[node_index];
+    unsigned int *slot = name_slot(functions, g, node->function);
+    if (!*slot) {
+        *slot = node_index + 1;
+        return NULL;
+    }
+    const graph_node *first = &g->nodes[*slot - 1];
+    return first->kind != node->kind ? first : NULL;
+}
+
+int read_graph(const char *file_name, graph *out)
+{
+    FILE *file = fopen(file_name, "r");
+    graph g = {0};
+    name_table names = {.key = offsetof(graph_node, name)}, functions = {.key = offsetof(graph_node, function)};
+    unsigned int nodes_size = 0, line_nr = 0;
+    char line[256], kind[16], name[GRAPH_NAME_MAX + 1], op[GRAPH_NAME_MAX + 2], parent1[GRAPH_NAME_MAX + 1],
+        parent2[GRAPH_NAME_MAX + 1];
+
+    if (!file) {
+        goto error;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        line_nr++;
+        if (sscanf(line, "%15s", kind) != 1 || kind[0] == '#') {
+            continue;  // empty line or comment
+        }
+
+        if (g.nr_of_nodes == nodes_size) {
+            nodes_size = nodes_size ? nodes_size * 2 : 64;
+            graph_node *nodes = realloc(g.nodes, nodes_size * sizeof(graph_node));
+            if (!nodes) {
+                goto error;
+            }
+            g.nodes = nodes;
+            if (name_table_reserve(&names, &g, nodes_size) != 0 ||
+                name_table_reserve(&functions, &g, nodes_size) != 0) {
+                goto error;
+            }
+        }
+        graph_node *node = &g.nodes[g.nr_of_nodes];
+        memset(node, 0, sizeof(graph_node));
+
+        if (strcmp(kind, "input") == 0 && sscanf(line, "%*s %32s %d", name, &node->value) == 2) {
+            node->kind = GRAPH_INPUT;
+            g.nr_of_inputs++;
+        } else if (strcmp(kind, "compute1") == 0 && sscanf(line, "%*s %32s %33s %32s", name, op, parent1) == 3) {
+            node->kind = GRAPH_COMPUTE1;
+            if (parse_op(node, op) != 0 || (node->op && !node->op->compute1) ||
+                find_parent(&names, &g, parent1, &node->parents[0]) != 0) {
+                goto parse_error;
+            }
+        } else if (strcmp(kind, "compute2") == 0 &&
+                   sscanf(line, "%*s %32s %33s %32s %32s", name, op, parent1, parent2) == 4) {
+            node->kind = GRAPH_COMPUTE2;
+            if (parse_op(node, op) != 0 || (node->op && !node->op->compute2) ||
+                find_parent(&names, &g, parent1, &node->parents[0]) != 0 ||
+                find_parent(&names, &g, parent2, &node->parents[1]) != 0) {
+                goto parse_error;
+            }
+        } else {
+            goto parse_error;
+        }
+
+        if (strlen(name) >= GRAPH_NAME_MAX || !is_identifier(name)) {
+            goto parse_error;
+        }
+        strcpy(node->name, name);
+        unsigned int *slot = name_slot(&names, &g, name);
+        if (*slot) {
+            goto parse_error;  // name already taken
+        }
+        const graph_node *other = node->kind != GRAPH_INPUT && !node->op ? other_arity(&functions, &g, g.nr_of_nodes)
+                                                                         : NULL;
+        if (other) {
+            fprintf(stderr, "%s:%u: function %s of %s has %d arguments, but %d in %s\n", file_name, line_nr,
+                    node->function, node->name, node->kind == GRAPH_COMPUTE1 ? 1 : 2,
+                    other->kind == GRAPH_COMPUTE1 ? 1 : 2, other->name);
+            goto error;
+        }
+        *slot = ++g.nr_of_nodes;
+    }
+    if (ferror(file) != 0 || g.nr_of_nodes == 0) {
+        goto error;
+    }
+
+    free(names.slots);
+    free(functions.slots);
+    fclose(file);
+    *out = g;
+    return 0;
+parse_error:
+    fprintf(stderr, "%s:%u: invalid line in graph description\n", file_name, line_nr);
+error:
+    if (file) {
+        fclose(file);
+    }
+    free(names.slots);
+    free(functions.slots);
+    free(g.nodes);
+    memset(out, 0, sizeof(graph));
+    return 1;
+}
+
+void free_graph(graph *g)
+{
+    if (!g) {
+        return;
+    }
+    free(g->nodes);
+    memset(g, 0, sizeof(graph));
+}
+
+struct cell **build_graph(const graph *g, struct reactor *r)
+{
+    if (!g || !r) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+
+    // all cells at once (parents come first in graph, as they must in specs)
+    struct cell **cells = malloc(g->nr_of_nodes * sizeof(struct cell *));
+    cell_spec *specs = calloc(g->nr_of_nodes, sizeof(cell_spec));
+    if (!cells || !specs) {
+        goto error;
+    }
+    for (unsigned int i = 0; i < g->nr_of_nodes; i++) {
+        const graph_node *node = &g->nodes[i];
+        if (node->kind != GRAPH_INPUT && !node->op) {
+            fprintf(stderr, "Function %s of %s is only supported by react_codegen\n", node->function, node->name);
+            goto error;
+        }
+        switch (node->kind) {
+            case GRAPH_INPUT:
+                specs[i].kind = CELL_SPEC_INPUT;
+                specs[i].value = node->value;
+                break;
+            case GRAPH_COMPUTE1:
+                specs[i].kind = CELL_SPEC_COMPUTE1;
+                specs[i].compute1 = node->op->compute1;
+                break;
+            case GRAPH_COMPUTE2:
+                specs[i].kind = CELL_SPEC_COMPUTE2;
+                specs[i].compute2 = node->op->compute2;
+                break;
+            default:
+                goto error;
+        }
+        specs[i].parent_specs[0] = node->parents[0];
+        specs[i].parent_specs[1] = node->parents[1];
+    }
+    if (reactor_add_cells(r, specs, g->nr_of_nodes, cells) != 0) {
+        goto error;
+    }
+    free(specs);
+    return cells;
+error:
+    free(specs);
+    free(cells);
+    return NULL;
+}
@@ -0,0 +1,52 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef REACT_GRAPH_H
+#define REACT_GRAPH_H
+#include "react.h"
+
+/*
+ * Graph description, a text file with one cell per line (in order of creation, so parents come first):
+ *
+ *   # comment
+ *   input    <name> <initial value>
+ *   compute1 <name> <op> <parent>
+ *   compute2 <name> <op> <parent 1> <parent 2>
+ *
+ * where name is a C identifier and op one of the built-in operations in graph_ops (react_graph.c),
+ *  or @<function> to call a C function int function(int) / int function(int, int) defined elsewhere
+ *  (with the same number of arguments wherever it is used).
+ *  Functions are only supported in generated code (react_codegen), not by build_graph.
+ */
+#define GRAPH_NAME_MAX 32
+
+typedef struct graph_op {
+    const char *name;
+    compute1 compute1;  // exactly one of compute1 and compute2 is set
+    compute2 compute2;
+    const char *expression;  // the same as C expression of arguments a (and b)
+} graph_op;
+
+enum graph_node_kind { GRAPH_INPUT, GRAPH_COMPUTE1, GRAPH_COMPUTE2 };
+
+typedef struct graph_node {
+    enum graph_node_kind kind;
+    char name[GRAPH_NAME_MAX];
+    int value;               // initial value (input)
+    const graph_op *op;      // (compute) NULL if function is called instead
+    char function[GRAPH_NAME_MAX];
+    unsigned int parents[2]; // index of parent nodes (compute)
+} graph_node;
+
+typedef struct graph {
+    graph_node *nodes;
+    unsigned int nr_of_nodes;
+    unsigned int nr_of_inputs;
+} graph;
+
+// returns 0 on success, free with free_graph
+int read_graph(const char *file_name, graph *);
+void free_graph(graph *);
+
+// create all cells of graph in reactor, returns list of the cells in order of nodes (caller frees)
+struct cell **build_graph(const graph *, struct reactor *);
+
+#endif
@@ -0,0 +1,238 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "react.h"
+#include "react_graph.h"
+
+/*
+ * Replay a log of updates to input cells through the reactor, as fast as possible.
+ *
+ *  react_replay [-b batch_size] <graph> <log>
+ *      replay log (recorded with reactor_start_recording) on the graph description,
+ *      one set_cell_value per record, or set_cell_values with batch_size records at a time.
+ *
+ *  react_replay -r <graph> <log> <nr of updates>
+ *      record a log of pseudo-random updates to input cells (via the reactor's recording).
+ *
+ * Prints updates per second, latency percentiles (per call), and a checksum of all cell values.
+ * The checksum after replay matches the one printed when recording, if all went well.
+ */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// FNV-1a over all cell values, in order of the graph description
+static uint64_t checksum(struct cell **cells, unsigned int nr_of_cells)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned int i = 0; i < nr_of_cells; i++) {
+        uint32_t value = (uint32_t)get_cell_value(cells[i]);
+        for (unsigned int byte = 0; byte < 4; byte++) {
+            hash = (hash ^ ((value >> (8 * byte)) & 0xff)) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+static void print_latencies(uint64_t *latencies, size_t nr_of_calls)
+{
+    const double percentiles[] = {50, 90, 99, 99.9};
+    if (nr_of_calls == 0) {
+        return;
+    }
+    qsort(latencies, nr_of_calls, sizeof(uint64_t), compare_u64);
+    printf("latency (ns):");
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        size_t index = (size_t)(percentiles[i] / 100.0 * (double)(nr_of_calls - 1));
+        printf(" p%g=%llu", percentiles[i], (unsigned long long)latencies[index]);
+    }
+    printf(" max=%llu\n", (unsigned long long)latencies[nr_of_calls - 1]);
+}
+
+static int replay(struct cell **inputs, unsigned int nr_of_inputs, const char *log_name, size_t batch_size)
+{
+    int rv = 1;
+    int fd = open(log_name, O_RDONLY);
+    struct stat st;
+    const unsigned char *map = MAP_FAILED;
+    uint64_t *latencies = NULL;
+    struct cell **batch_cells = NULL;
+    int *batch_values = NULL;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < REACTOR_LOG_MAGIC_SIZE) {
+        fprintf(stderr, "Could not open log %s\n", log_name);
+        goto cleanup;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED || memcmp(map, REACTOR_LOG_MAGIC, REACTOR_LOG_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "Not a reactor log: %s\n", log_name);
+        goto cleanup;
+    }
+    madvise((void *)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const reactor_log_record *records = (const reactor_log_record *)(const void *)(map + REACTOR_LOG_MAGIC_SIZE);
+    size_t nr_of_records = ((size_t)st.st_size - REACTOR_LOG_MAGIC_SIZE) / sizeof(reactor_log_record);
+    for (size_t i = 0; i < nr_of_records; i++) {
+        if (records[i].input_index >= nr_of_inputs) {
+            fprintf(stderr, "Record %zu: no input cell %u in graph\n", i, records[i].input_index);
+            goto cleanup;
+        }
+    }
+
+    size_t nr_of_calls = (nr_of_records + batch_size - 1) / batch_size;
+    latencies = malloc((nr_of_calls ? nr_of_calls : 1) * sizeof(uint64_t));
+    batch_cells = malloc(batch_size * sizeof(struct cell *));
+    batch_values = malloc(batch_size * sizeof(int));
+    if (!latencies || !batch_cells || !batch_values) {
+        goto cleanup;
+    }
+
+    uint64_t start = now_ns();
+    for (size_t call = 0; call < nr_of_calls; call++) {
+        size_t first = call * batch_size;
+        size_t nr = nr_of_records - first < batch_size ? nr_of_records - first : batch_size;
+        uint64_t call_start;
+
+        if (batch_size == 1) {
+            call_start = now_ns();
+            set_cell_value(inputs[records[first].input_index], records[first].value);
+        } else {
+            for (size_t i = 0; i < nr; i++) {
+                batch_cells[i] = inputs[records[first + i].input_index];
+                batch_values[i] = records[first + i].value;
+            }
+            call_start = now_ns();
+            set_cell_values(batch_cells, batch_values, nr);
+        }
+        latencies[call] = now_ns() - call_start;
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    printf("%zu updates in %zu calls, %.3f s, %.0f updates/s\n", nr_of_records, nr_of_calls, seconds,
+           seconds > 0 ? (double)nr_of_records / seconds : 0);
+    print_latencies(latencies, nr_of_calls);
+    rv = 0;
+cleanup:
+    free(batch_values);
+    free(batch_cells);
+    free(latencies);
+    if (map != MAP_FAILED) {
+        munmap((void *)map, (size_t)st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return rv;
+}
+
+static int record(struct reactor *r, struct cell **inputs, unsigned int nr_of_inputs, const char *log_name,
+                  size_t nr_of_updates)
+{
+    uint64_t state = 88172645463325252ULL;  // xorshift64, fixed seed so runs are repeatable
+
+    if (nr_of_inputs == 0 || reactor_start_recording(r, log_name) != 0) {
+        fprintf(stderr, "Could not record to %s\n", log_name);
+        return 1;
+    }
+    for (size_t i = 0; i < nr_of_updates; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        set_cell_value(inputs[(state >> 32) % nr_of_inputs], (int)(state & 0xffff) - 0x8000);
+    }
+    reactor_stop_recording(r);
+    printf("%zu updates recorded to %s\n", nr_of_updates, log_name);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: react_replay [-b batch_size] <graph> <log>\n"
+            "       react_replay -r <graph> <log> <nr of updates>\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int rv = 1;
+    size_t batch_size = 1;
+    long nr_of_updates = -1;
+    int arg = 1;
+    graph g;
+    struct reactor *r = NULL;
+    struct cell **cells = NULL, **inputs = NULL;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-b") == 0) {
+        long value = strtol(argv[arg + 1], NULL, 10);
+        if (value <= 0) {
+            usage();
+        }
+        batch_size = (size_t)value;
+        arg += 2;
+    } else if (arg < argc && strcmp(argv[arg], "-r") == 0) {
+        if (argc != 5 || (nr_of_updates = strtol(argv[4], NULL, 10)) < 0) {
+            usage();
+        }
+        arg++;
+    }
+    if (arg + 2 != argc && !(nr_of_updates >= 0 && arg + 3 == argc)) {
+        usage();
+    }
+
+    if (read_graph(argv[arg], &g) != 0) {
+        fprintf(stderr, "Could not read graph %s\n", argv[arg]);
+        return 1;
+    }
+    r = create_reactor();
+    cells = build_graph(&g, r);
+    inputs = malloc((g.nr_of_inputs ? g.nr_of_inputs : 1) * sizeof(struct cell *));
+    if (!r || !cells || !inputs) {
+        goto cleanup;
+    }
+    for (unsigned int i = 0, input = 0; i < g.nr_of_nodes; i++) {
+        if (g.nodes[i].kind == GRAPH_INPUT) {
+            inputs[input++] = cells[i];
+        }
+    }
+    // every cell is observed, otherwise the reactor would skip computing all of them (see pin_cell)
+    for (unsigned int i = 0; i < g.nr_of_nodes; i++) {
+        pin_cell(cells[i]);
+    }
+    printf("graph: %u cells, %u inputs\n", g.nr_of_nodes, g.nr_of_inputs);
+
+    if (nr_of_updates >= 0) {
+        rv = record(r, inputs, g.nr_of_inputs, argv[arg + 1], (size_t)nr_of_updates);
+    } else {
+        rv = replay(inputs, g.nr_of_inputs, argv[arg + 1], batch_size);
+    }
+    if (rv == 0) {
+        printf("checksum: %016llx\n", (unsigned long long)checksum(cells, g.nr_of_nodes));
+    }
+
+cleanup:
+    free(inputs);
+    free(cells);
+    if (r) {
+        destroy_reactor(r);
+    }
+    free_graph(&g);
+    return rv;
+}
@@ -0,0 +1,135 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct thread_pool {
+    pthread_t *threads;
+    unsigned int nr_of_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;  // signaled when a new run is started (or pool is stopped)
+    pthread_cond_t done_cond;  // signaled when the last busy worker is done
+    unsigned long generation;  // increased for every run, so sleeping workers know there is new work
+    bool stop;
+
+    /* current run, protected by lock */
+    thread_pool_task func;
+    void *arg;
+    size_t nr_of_tasks;
+    size_t next_task;
+    unsigned int busy_workers;
+};
+
+// take tasks until there are none left, lock must be held when called (and is held on return)
+static void run_tasks(struct thread_pool *pool)
+{
+    while (pool->next_task < pool->nr_of_tasks) {
+        size_t task_nr = pool->next_task++;
+        thread_pool_task func = pool->func;
+        void *arg = pool->arg;
+
+        pthread_mutex_unlock(&pool->lock);
+        func(arg, task_nr);
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+static void *worker_main(void *p)
+{
+    struct thread_pool *pool = p;
+    unsigned long seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen_generation = pool->generation;
+
+        pool->busy_workers++;
+        run_tasks(pool);
+        pool->busy_workers--;
+        if (pool->busy_workers == 0) {
+            pthread_cond_broadcast(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(unsigned int nr_of_threads)
+{
+    struct thread_pool *pool = calloc(1, sizeof(struct thread_pool));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (nr_of_threads > 1) {
+        pool->threads = calloc(nr_of_threads - 1, sizeof(pthread_t));
+        if (!pool->threads) {
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    // the caller is the first thread, only start the others
+    for (unsigned int i = 0; i + 1 < nr_of_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            fprintf(stderr, "Sorry! Could only start %u of %u threads\n", i + 1, nr_of_threads);
+            break;
+        }
+        pool->nr_of_workers++;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->nr_of_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+void thread_pool_run(struct thread_pool *pool, size_t nr_of_tasks, thread_pool_task func, void *arg)
+{
+    if (!pool || !func) {
+        fprintf(stderr, "Invalid input given\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->arg = arg;
+    pool->nr_of_tasks = nr_of_tasks;
+    pool->next_task = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    // help out, then wait for the workers still running a task
+    run_tasks(pool);
+    while (pool->busy_workers > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,22 @@
+// Copyright 2022 Eliot Roxbergh. Licensed under AGPLv3 as per separate LICENSE file
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <stddef.h>
+
+/*
+ * Small fork-join thread pool:
+ *  the workers sleep until thread_pool_run() hands them a set of tasks,
+ *  and thread_pool_run() returns only when all of these tasks are done.
+ */
+struct thread_pool;
+
+typedef void (*thread_pool_task)(void *arg, size_t task_nr);
+
+// nr_of_threads includes the calling thread, so nr_of_threads-1 workers are started
+struct thread_pool *thread_pool_create(unsigned int nr_of_threads);
+void thread_pool_destroy(struct thread_pool *);
+
+// run func(arg, i) for i in [0, nr_of_tasks), the calling thread also takes tasks while waiting
+void thread_pool_run(struct thread_pool *, size_t nr_of_tasks, thread_pool_task func, void *arg);
+
+#endif